@@ -5,6 +5,9 @@
 
 #define BOARD_TCXO_WAKEUP_TIME                      5
 
+/* SX1262 regulator: USE_DCDC (module fitted with the DC-DC inductor) or USE_LDO */
+#define BOARD_RADIO_REGULATOR_MODE                  USE_DCDC
+
 /* sx162 LoRa Module Pins */
 
 #define LORA_SCK         PA_5
@@ -19,6 +22,17 @@
 /* DHT Pin */
 #define DHT_11_PIN       PB_3
 
+/*
+ * DHT 11 probes, up to 4 on different TIM2 channels:
+ * CH1 PA_0/PA_15, CH2 PA_1/PB_3, CH3 PA_2, CH4 PB_11
+ */
+#define DHT_PINS         { DHT_11_PIN }
+
+/* SHT3x on I2C1 (-DLORAWAN_SENSOR_SHT3X=ON), external pull-ups, ADDR pin low */
+#define SHT3X_SCL        PB_8
+#define SHT3X_SDA        PB_9
+#define SHT3X_ADDRESS    0x44
+
 /* ADC Pin */
 #define ADC_PIN          PA_3
 
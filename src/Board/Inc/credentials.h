@@ -0,0 +1,47 @@
+#ifndef __CREDENTIALS_H
+#define __CREDENTIALS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "lorawan.h"
+
+/* Marker the provisioning tool (tools/provision.py) searches for in the .bin,
+   the record must be the only place it appears. Also spelt backwards in credentials.c */
+#define CREDENTIALS_MAGIC               "LWCRED01"
+#define CREDENTIALS_MAGIC_SIZE          8
+
+/* Fields present in the record */
+#define CREDENTIALS_HAS_DEV_EUI         ( 1 << 0 )
+#define CREDENTIALS_HAS_JOIN_EUI        ( 1 << 1 )
+#define CREDENTIALS_HAS_APP_KEY         ( 1 << 2 )
+#define CREDENTIALS_HAS_DEV_ADDR        ( 1 << 3 )
+#define CREDENTIALS_HAS_NWK_S_KEY       ( 1 << 4 )
+#define CREDENTIALS_HAS_APP_S_KEY       ( 1 << 5 )
+#define CREDENTIALS_HAS_CHANNEL_MASK    ( 1 << 6 )
+
+/**
+ * LoRaWAN credentials record
+ *
+ * @note Lives in the .lorawan_credentials flash section. The layout is shared
+ *       with tools/provision.py and must only be extended at the end.
+ *       Multi-byte integers are little-endian, EUIs and keys are MSB first.
+ */
+typedef struct{
+    uint8_t Magic[CREDENTIALS_MAGIC_SIZE];
+    uint8_t Flags;
+    uint8_t Reserved[3];
+    uint8_t DevEui[8];
+    uint8_t JoinEui[8];
+    uint8_t AppKey[16];
+    uint32_t DevAddr;
+    uint8_t NwkSKey[16];
+    uint8_t AppSKey[16];
+    uint16_t ChannelMask[6];
+} Credentials_t;
+
+bool Credentials_IsValid( void );
+void Credentials_GetOtaaSettings( struct lorawan_otaa_settings *settings );
+void Credentials_GetAbpSettings( struct lorawan_abp_settings *settings );
+
+#endif
@@ -0,0 +1,8 @@
+#ifndef __CRYPTO_BENCH_H
+#define __CRYPTO_BENCH_H
+
+#include <stdbool.h>
+
+bool CryptoBench_Run( void );
+
+#endif
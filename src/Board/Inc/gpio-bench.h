@@ -0,0 +1,6 @@
+#ifndef __GPIO_BENCH_H
+#define __GPIO_BENCH_H
+
+void GpioBench_Run( void );
+
+#endif
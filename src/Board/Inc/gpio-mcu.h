@@ -0,0 +1,54 @@
+#ifndef __GPIO_MCU_H
+#define __GPIO_MCU_H
+
+/* Board specific extensions of the GPIO driver (see gpio-board.h) */
+
+#include <stdint.h>
+
+#include "gpio.h"
+#include "stm32f4xx.h"
+
+/*
+ * Register level fast path for timing critical code (DHT bit timing, radio
+ * NSS and BUSY). The port and the pin mask are resolved by GpioMcuInit, the
+ * accessors are always inlined so the Debug (-O0) build gets the same timing
+ * as the optimized one. No NC or IO expander pins.
+ */
+#define GPIO_MCU_INLINE         static inline __attribute__(( always_inline ))
+
+/**
+ * @brief Reads the GPIO input
+ *
+ * @param [IN] obj Pointer to the GPIO object
+ * @return value   0 or 1
+ */
+GPIO_MCU_INLINE uint32_t GpioMcuFastRead( const Gpio_t *obj ){
+    return ((((GPIO_TypeDef *)obj->port)->IDR & obj->pinIndex) != 0) ? 1 : 0;
+}
+
+/**
+ * @brief Writes the GPIO output in a single store
+ *
+ * @param [IN] obj   Pointer to the GPIO object
+ * @param [IN] value New GPIO output value
+ */
+GPIO_MCU_INLINE void GpioMcuFastWrite( const Gpio_t *obj, uint32_t value ){
+    ((GPIO_TypeDef *)obj->port)->BSRR = (value != 0) ? obj->pinIndex : ((uint32_t)obj->pinIndex << 16);
+}
+
+/**
+ * @brief Parks the pins not in use in analog mode and gates the clock of the
+ *        ports left without a pin in use, see lpm-board.c
+ */
+void GpioMcuParkUnused( void );
+
+/**
+ * @brief Gets the number of interrupts taken on an EXTI line
+ *
+ * @param [IN] line EXTI line, the pin number [0..15]
+ *
+ * @return uint32_t, interrupts since reset
+ */
+uint32_t GpioMcuGetIrqCount( uint8_t line );
+
+#endif
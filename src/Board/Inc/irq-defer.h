@@ -0,0 +1,40 @@
+#ifndef __IRQ_DEFER_H
+#define __IRQ_DEFER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef void ( *IrqDeferHandler_t )( void *context );
+
+/**
+ * Interrupt sources, one queue each
+ *
+ * @note A queue has a single producer: every source must only be posted from
+ *       one interrupt vector, which cannot preempt itself.
+ */
+typedef enum{
+    IRQ_DEFER_SOURCE_RTC_ALARM,
+    IRQ_DEFER_SOURCE_EXTI0,
+    IRQ_DEFER_SOURCE_EXTI1,
+    IRQ_DEFER_SOURCE_EXTI2,
+    IRQ_DEFER_SOURCE_EXTI3,
+    IRQ_DEFER_SOURCE_EXTI4,
+    IRQ_DEFER_SOURCE_EXTI9_5,
+    IRQ_DEFER_SOURCE_EXTI15_10,
+    IRQ_DEFER_SOURCE_COUNT
+} IrqDeferSource_t;
+
+typedef struct{
+    uint32_t Posted;
+    uint32_t Dropped;               /* queue full */
+    uint8_t MaxDepth;               /* deepest queue seen */
+    uint32_t MaxLatencyCycles;      /* interrupt to handler start */
+    uint32_t MaxHandlerCycles;      /* longest handler */
+} IrqDeferStats_t;
+
+void IrqDefer_Init( void );
+bool IrqDefer_Post( IrqDeferSource_t source, IrqDeferHandler_t handler, void *context );
+IrqDeferSource_t IrqDefer_ExtiSource( uint8_t line );
+void IrqDefer_GetStats( IrqDeferStats_t *stats );
+
+#endif
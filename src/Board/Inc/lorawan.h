@@ -15,21 +15,143 @@ struct lorawan_sx126x_settings {
     } spi;
 };
 
+/* Credentials are binary (EUIs and keys MSB first), see credentials.h */
 struct lorawan_abp_settings {
-    const char* device_address;
-    const char* network_session_key;
-    const char* app_session_key;
-    const char* channel_mask;
+    const uint32_t* device_address;
+    const uint8_t* network_session_key;
+    const uint8_t* app_session_key;
+    const uint16_t* channel_mask;
 };
 
 struct lorawan_otaa_settings {
-    const char* device_eui;
-    const char* app_eui;
-    const char* app_key;
-    const char* channel_mask;
+    const uint8_t* device_eui;
+    const uint8_t* app_eui;
+    const uint8_t* app_key;
+    const uint16_t* channel_mask;
 };
 
 
+/* Outcome of an uplink request */
+enum lorawan_tx_status {
+    LORAWAN_TX_DONE,        /* unconfirmed frame transmitted */
+    LORAWAN_TX_ACKED,       /* confirmed frame acknowledged by the network */
+    LORAWAN_TX_NOT_ACKED,   /* confirmed frame not acknowledged after all retries */
+    LORAWAN_TX_ERROR,       /* frame could not be transmitted */
+    LORAWAN_TX_SUPERSEDED   /* scheduled frame replaced by a newer one before the band was free */
+};
+
+struct lorawan_tx_result {
+    int handle;
+    enum lorawan_tx_status status;
+    uint8_t attempts;
+    uint8_t channel;
+    int8_t datarate;
+    int8_t tx_power;
+    uint32_t uplink_counter;
+    uint32_t airtime_ms;    /* summed over all attempts */
+};
+
+/* Maximum application payload of a downlink frame */
+#define LORAWAN_RX_FRAME_MAX_SIZE   242
+
+/* Downlink frame held in the receive queue */
+struct lorawan_rx_frame {
+    uint8_t port;
+    uint8_t size;
+    int16_t rssi;
+    int8_t snr;
+    uint32_t timestamp_ms;  /* TimerGetCurrentTime at reception */
+    uint8_t data[LORAWAN_RX_FRAME_MAX_SIZE];
+};
+
+struct lorawan_rx_stats {
+    uint32_t received;      /* frames queued */
+    uint32_t dropped;       /* frames lost because the queue was full */
+    uint8_t depth;          /* frames currently queued */
+    uint8_t max_depth;      /* high-water mark */
+};
+
+/* Events reported by the MAC layer, see lorawan_event_wait */
+enum lorawan_event_type {
+    LORAWAN_EVENT_JOINED,
+    LORAWAN_EVENT_JOIN_FAILED,          /* a new join attempt is started automatically */
+    LORAWAN_EVENT_TX_DONE,
+    LORAWAN_EVENT_RX,                   /* the frame is waiting in the receive queue */
+    LORAWAN_EVENT_CLASS_CHANGED,
+    LORAWAN_EVENT_TIME_SYNCED,
+    LORAWAN_EVENT_DUTY_CYCLE_BLOCKED,   /* request refused, retry after next_tx_in_ms */
+    LORAWAN_EVENT_PAYLOAD_TOO_LARGE     /* frame refused, see lorawan_get_tx_limits */
+};
+
+struct lorawan_event {
+    enum lorawan_event_type type;
+    union {
+        struct {
+            int8_t datarate;
+        } joined;
+        struct lorawan_tx_result tx;    /* handle is 0 for frames sent through the stack */
+        struct {
+            uint8_t port;
+            uint8_t size;
+            int16_t rssi;
+            int8_t snr;
+        } rx;
+        DeviceClass_t device_class;
+        struct {
+            bool synchronized;
+            int32_t correction_s;       /* applied to the system time, 0 for a DeviceTimeAns */
+        } time;
+        struct {
+            uint32_t next_tx_in_ms;
+        } duty_cycle;
+        struct {
+            uint8_t size;               /* refused application payload */
+            uint8_t max_payload;
+            uint8_t mac_overhead;       /* non zero when MAC commands took the room */
+        } payload;
+    };
+};
+
+typedef void (*lorawan_tx_callback_t)(const struct lorawan_tx_result* result, void* context);
+
+struct lorawan_retry_policy {
+    uint8_t max_retries;    /* re-sends of a confirmed frame that got no ACK */
+    bool lower_datarate;    /* step the datarate down on each re-send, only when ADR is off */
+    uint8_t nb_trans;       /* transmissions of each unconfirmed frame [1..15] */
+};
+
+/* Room for the next uplink at the current datarate */
+struct lorawan_tx_limits {
+    int8_t datarate;
+    uint8_t max_payload;    /* application payload allowed by the datarate */
+    uint8_t mac_overhead;   /* taken by the MAC commands waiting to be sent */
+    uint8_t available;      /* max_payload - mac_overhead */
+};
+
+/* Self-contained application record, see lorawan_pack_records */
+struct lorawan_record {
+    const void* data;
+    uint8_t size;
+    uint8_t priority;       /* 0 is the most important */
+    bool packed;            /* set once the record went into a frame */
+};
+
+/* Link quality targets used when ADR is off */
+struct lorawan_link_policy {
+    uint8_t margin_db;              /* SNR margin kept above the demodulation floor */
+    uint8_t link_check_interval;    /* uplinks between LinkCheckReq, 0 disables */
+};
+
+struct lorawan_link_stats {
+    int16_t rssi;                   /* last downlink */
+    int8_t snr;                     /* last downlink, normalised to 125 kHz */
+    int8_t snr_min;                 /* worst of the recent downlinks */
+    uint8_t samples;
+    int8_t datarate;                /* uplink datarate in use */
+    int8_t tx_power;                /* TX_POWER index in use */
+    uint8_t unanswered_checks;
+};
+
 int lorawan_init_abp(LoRaMacRegion_t region, const struct lorawan_abp_settings* abp_settings);
 
 int lorawan_init_otaa(LoRaMacRegion_t region, const struct lorawan_otaa_settings* otaa_settings);
@@ -38,14 +160,57 @@ int lorawan_join();
 
 int lorawan_is_joined();
 
+/* Asks the network for the time, LORAWAN_EVENT_TIME_SYNCED follows the answer */
+int lorawan_request_time(void);
+
 int lorawan_process();
 
+/* True when lorawan_process has nothing left to do and the MCU may sleep */
+bool lorawan_is_idle(void);
+
 int lorawan_process_timeout_ms(uint32_t timeout_ms);
 
 int lorawan_send_unconfirmed(const void* data, uint8_t data_len, uint8_t app_port);
 
+int lorawan_send_confirmed(const void* data, uint8_t data_len, uint8_t app_port);
+
+int lorawan_send(const void* data, uint8_t data_len, uint8_t app_port, bool confirmed,
+                 lorawan_tx_callback_t callback, void* context);
+
+/* Like lorawan_send, but a frame refused by the duty cycle is kept and sent as
+   soon as the band is free. A newer frame replaces it. */
+int lorawan_send_scheduled(const void* data, uint8_t data_len, uint8_t app_port, bool confirmed,
+                           lorawan_tx_callback_t callback, void* context);
+
+/* Time until the duty cycle allows the next uplink, 0 when free or unknown */
+uint32_t lorawan_next_tx_in_ms(void);
+
+int lorawan_get_tx_limits(struct lorawan_tx_limits* limits);
+
+/* Packs the most important records not packed yet that fit in max_size bytes,
+   returns the frame size, 0 when no record is left or none fits */
+uint8_t lorawan_pack_records(struct lorawan_record* records, uint8_t count, uint8_t max_size, uint8_t* frame);
+
+int lorawan_set_retry_policy(const struct lorawan_retry_policy* policy);
+
+int lorawan_set_adr(bool enable);
+
+int lorawan_set_link_policy(const struct lorawan_link_policy* policy);
+
+void lorawan_get_link_stats(struct lorawan_link_stats* stats);
+
 int lorawan_receive(void* data, uint8_t data_len, uint8_t* app_port);
 
+const struct lorawan_rx_frame* lorawan_rx_borrow(void);
+
+void lorawan_rx_release(void);
+
+void lorawan_rx_get_stats(struct lorawan_rx_stats* stats);
+
+bool lorawan_event_get(struct lorawan_event* event);
+
+int lorawan_event_wait(struct lorawan_event* event, uint32_t timeout_ms);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,34 @@
+#ifndef __LPM_MCU_H
+#define __LPM_MCU_H
+
+/* Board specific extensions of the low power manager (see lpm-board.h) */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef void ( *LpmPeriphHandler_t )( void *context );
+
+/**
+ * Peripheral switched off around the low power modes
+ *
+ * @note Owned by the driver, registered once with LpmRegisterPeriph. Suspend
+ *       gates the clocks and parks the pins in analog mode, resume brings the
+ *       peripheral back as it was. Both run with the interrupts masked.
+ */
+typedef struct LpmPeriph_s{
+    const char *Name;
+    LpmPeriphHandler_t Suspend;
+    LpmPeriphHandler_t Resume;
+    void *Context;
+    uint32_t Resumes;
+    uint32_t ResumeCycles;          /* last resume, DWT cycles */
+    uint32_t MaxResumeCycles;
+    struct LpmPeriph_s *Next;
+} LpmPeriph_t;
+
+void LpmRegisterPeriph( LpmPeriph_t *periph, const char *name, LpmPeriphHandler_t suspend, LpmPeriphHandler_t resume, void *context );
+void LpmSuspendPeriphs( void );
+void LpmResumePeriphs( void );
+const LpmPeriph_t *LpmGetPeriphs( void );
+
+#endif
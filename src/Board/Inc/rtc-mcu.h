@@ -0,0 +1,16 @@
+#ifndef __RTC_MCU_H
+#define __RTC_MCU_H
+
+/* Board specific extensions of the RTC driver (see rtc-board.h) */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* DR0 and DR1 hold the SysTime offset, DR2 marks the calendar as set */
+#define RTC_BKUP_FIRST_FREE     3
+
+bool RtcIsCalendarKept( void );
+void RtcBkupWriteIndex( uint8_t index, uint32_t data );
+uint32_t RtcBkupReadIndex( uint8_t index );
+
+#endif
@@ -0,0 +1,43 @@
+#ifndef __SCHEDULER_H
+#define __SCHEDULER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "timer.h"
+
+typedef void ( *SchedulerTaskFn_t )( void *context );
+
+/**
+ * Run-to-completion task
+ *
+ * @note Owned by the caller, registered once with Scheduler_AddTask.
+ */
+typedef struct SchedulerTask_s{
+    SchedulerTaskFn_t Run;
+    void *Context;
+    const char *Name;
+    TimerTime_t Deadline;
+    uint32_t PeriodMs;              /* 0 for a one-shot task */
+    uint32_t SlackMs;               /* may run that much early to share a wake-up */
+    bool Active;
+    uint32_t Runs;
+    uint32_t MaxLatenessMs;         /* worst delay past the deadline */
+    struct SchedulerTask_s *Next;
+} SchedulerTask_t;
+
+typedef struct{
+    uint32_t WakeUps;               /* sleeps ended, whatever the wake source */
+    uint32_t TaskRuns;
+} SchedulerStats_t;
+
+void Scheduler_Init( void );
+void Scheduler_AddTask( SchedulerTask_t *task, SchedulerTaskFn_t run, void *context, const char *name, uint32_t slackMs );
+void Scheduler_Start( SchedulerTask_t *task, uint32_t delayMs, uint32_t periodMs );
+void Scheduler_Stop( SchedulerTask_t *task );
+void Scheduler_Process( void );
+bool Scheduler_IsDue( void );
+void Scheduler_Sleep( bool (*canSleep)( void ) );
+void Scheduler_GetStats( SchedulerStats_t *stats );
+
+#endif
@@ -0,0 +1,106 @@
+#ifndef __SX1262_BOARD_H
+#define __SX1262_BOARD_H
+
+/* Board specific extensions of the SX126x driver (see sx126x-board.h) */
+
+#include <stdint.h>
+#include "sx126x-board.h"
+
+/*!
+ * \brief Gets the measured on-air time of the last transmission
+ *
+ * \retval airTime Time between SetTx and the TxDone/Timeout interrupt [ms]
+ */
+uint32_t SX126xGetTxAirTimeMs( void );
+
+/*!
+ * \brief Radio power manager statistics
+ */
+typedef struct SX126xPowerStats_s
+{
+    uint32_t Wakeups;
+    uint32_t WakeLatencyUs;             //!< Last wake-up, NSS pulse to BUSY low
+    uint32_t WakeLatencyMaxUs;
+    uint32_t WakeToTxUs;                //!< Last wake-up to SetTx, includes the configuration
+    uint32_t WakeToTxMaxUs;
+    uint32_t CalibrationsSkipped;       //!< Calibrations already valid
+    uint32_t ImageCalibrationsSkipped;  //!< Image calibrations for the band already applied
+}SX126xPowerStats_t;
+
+/*!
+ * \brief Gets the radio wake-up and calibration statistics
+ *
+ * \param [OUT] stats Statistics
+ */
+void SX126xGetPowerStats( SX126xPowerStats_t *stats );
+
+/*!
+ * \brief Command pipeline statistics
+ */
+typedef struct SX126xCommandStats_s
+{
+    uint32_t Sent;
+    uint32_t Skipped;                   //!< Commands matching the retained radio configuration
+}SX126xCommandStats_t;
+
+/*!
+ * \brief Gets the number of commands sent and skipped
+ *
+ * \param [OUT] stats Statistics
+ */
+void SX126xGetCommandStats( SX126xCommandStats_t *stats );
+
+/*!
+ * \brief Register shadow cache statistics, one count per read access
+ */
+typedef struct SX126xRegisterCacheStats_s
+{
+    uint32_t Hits;                      //!< Served from RAM
+    uint32_t Misses;                    //!< Cached registers read over SPI
+    uint32_t Uncached;                  //!< Status registers, always read over SPI
+}SX126xRegisterCacheStats_t;
+
+/*!
+ * \brief Gets the register shadow cache statistics
+ *
+ * \param [OUT] stats Statistics
+ */
+void SX126xGetRegisterCacheStats( SX126xRegisterCacheStats_t *stats );
+
+/*!
+ * \brief RX gain selection
+ */
+typedef enum
+{
+    SX126X_RX_GAIN_POWER_SAVING,        //!< Routine receive windows
+    SX126X_RX_GAIN_BOOSTED,             //!< Better sensitivity for about 0.7 mA more, used while joining
+}SX126xRxGain_t;
+
+/*!
+ * \brief Radio power profile in use
+ */
+typedef struct SX126xPowerProfile_s
+{
+    int8_t TxPower;                     //!< Output power [dBm]
+    uint8_t PaDutyCycle;
+    uint8_t HpMax;
+    SX126xRxGain_t RxGain;
+    uint16_t TxCurrentMa;               //!< Estimated TX current [mA]
+    uint16_t RxCurrentUa;               //!< Estimated RX current [uA]
+}SX126xPowerProfile_t;
+
+/*!
+ * \brief Selects the RX gain applied to the following receptions
+ *
+ * \param [IN] gain RX gain
+ */
+void SX126xSetRxGainProfile( SX126xRxGain_t gain );
+
+/*!
+ * \brief Gets the power profile in use and its estimated currents
+ *
+ * \param [OUT] profile Power profile
+ */
+void SX126xGetPowerProfile( SX126xPowerProfile_t *profile );
+
+#endif
@@ -0,0 +1,27 @@
+#ifndef __TIME_SYNC_H
+#define __TIME_SYNC_H
+
+/* GPS time from the network, carried over the RTC between two syncs */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "systime.h"
+
+/**
+ * Sync statistics
+ */
+typedef struct{
+    uint32_t Syncs;
+    uint32_t LastSyncGps;           /* GPS seconds of the last sync, 0 before the first */
+    int32_t LastErrorMs;            /* own time minus network time at the last sync */
+    int32_t DriftPpb;               /* RTC rate error, positive when fast */
+    bool DriftKnown;
+} TimeSync_Stats_t;
+
+void TimeSync_Init( void );
+void TimeSync_OnUpdate( void );
+bool TimeSync_GetGpsTime( SysTime_t *time );
+uint32_t TimeSync_GetResyncMs( void );
+void TimeSync_GetStats( TimeSync_Stats_t *stats );
+
+#endif
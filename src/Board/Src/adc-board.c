@@ -13,12 +13,17 @@
 
 #include "adc-board.h"
 #include "gpio-board.h"
+#include "lpm-mcu.h"
 
 #include "stm32f4xx_hal.h"
 #include "stm32f4xx_hal_adc.h"
 
 /* ADC Handler definition */
 ADC_HandleTypeDef hadc1;
+static LpmPeriph_t adcPeriph;
+
+static void AdcMcuSuspend( void *context );
+static void AdcMcuResume( void *context );
 
 /**
  * @brief Initializes the ADC object 
@@ -64,7 +69,24 @@ void AdcMcuConfig( void )
         printf("Error configuring the Channel 3\n");
         return 0;
     }
-    
+
+    LpmRegisterPeriph(&adcPeriph, "adc", AdcMcuSuspend, AdcMcuResume, NULL);
+}
+
+/**
+ * @brief Powers the ADC down for low power, the input pin is already analog
+ */
+static void AdcMcuSuspend( void *context ){
+    __HAL_ADC_DISABLE(&hadc1);
+    __HAL_RCC_ADC1_CLK_DISABLE();
+}
+
+/**
+ * @brief Restores the ADC clock, HAL_ADC_Start powers the ADC up on the next
+ *        conversion
+ */
+static void AdcMcuResume( void *context ){
+    __HAL_RCC_ADC1_CLK_ENABLE();
 }
 
 /**
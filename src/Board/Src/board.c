@@ -10,6 +10,11 @@
 /* Includes */
 #include "board.h"
 #include "main.h"
+#include "gpio-board.h"
+#include "irq-defer.h"
+#include "lpm-board.h"
+#include "lpm-mcu.h"
+#include "utilities.h"
 
 #define BOARD_VERSION           1
 
@@ -24,10 +29,18 @@
 #define ID_2                    ID_BASE_ADDR + ID_OFFSET_2
 
 
+/* Debugging UART pins */
+#define UART_TX                 PB_6
+#define UART_RX                 PB_7
+
 /* Variables */
 UART_HandleTypeDef huart1;
+static Gpio_t uartTx, uartRx;
+static LpmPeriph_t uartPeriph;
 static void SystemClock_Config(void);
 static void MX_USART1_UART_Init(void);
+static void UartSuspend( void *context );
+static void UartResume( void *context );
 
 /* printf uart function */
 int _write(int file, char *ptr, int len){
@@ -48,6 +61,9 @@ void BoardInitMcu( void ){
     /* Configure the system clock */
     SystemClock_Config();
 
+    /* Interrupt handlers defer their work to PendSV */
+    IrqDefer_Init();
+
     /* Setting up UART1 for debugging */
     MX_USART1_UART_Init();
 
@@ -71,9 +87,12 @@ void BoardInitPeriph( void ){
 /**
  * @brief De-initializes the target board peripherals to decrease power
  *        consumption.
+ *
+ * @note The drivers switch their peripherals off through the hooks registered
+ *       with the low power manager, LpmEnterLowPower restores them.
  */
 void BoardDeInitMcu( void ){
-
+    LpmSuspendPeriphs();
 }
 
 /**
@@ -94,9 +113,14 @@ void BoardGetUniqueId( uint8_t *id ){
 
 /**
  * @brief Manages the entry into ARM cortex deep-sleep mode
+ *
+ * @note The interrupt mask of the caller is restored on exit, a caller
+ *       already in a critical section stays in it.
  */
 void BoardLowPowerHandler( void ){
-
+    CRITICAL_SECTION_BEGIN();
+    LpmEnterLowPower();
+    CRITICAL_SECTION_END();
 }
 
 /**
@@ -197,18 +221,11 @@ static void SystemClock_Config(void)
  */
 static void MX_USART1_UART_Init( void ){
 
-    GPIO_InitTypeDef GPIO_InitStruct = {0};
-
     /* Peripheral clock enable */
     __HAL_RCC_USART1_CLK_ENABLE();
-    __HAL_RCC_GPIOB_CLK_ENABLE();
 
-    GPIO_InitStruct.Pin = GPIO_PIN_6|GPIO_PIN_7;
-    GPIO_InitStruct.Mode = GPIO_MODE_AF_PP;
-    GPIO_InitStruct.Pull = GPIO_NOPULL;
-    GPIO_InitStruct.Speed = GPIO_SPEED_FREQ_VERY_HIGH;
-    GPIO_InitStruct.Alternate = GPIO_AF7_USART1;
-    HAL_GPIO_Init(GPIOB, &GPIO_InitStruct);
+    GpioMcuInit(&uartTx, UART_TX, PIN_ALTERNATE_FCT, PIN_PUSH_PULL, PIN_NO_PULL, GPIO_AF7_USART1);
+    GpioMcuInit(&uartRx, UART_RX, PIN_ALTERNATE_FCT, PIN_PUSH_PULL, PIN_NO_PULL, GPIO_AF7_USART1);
 
     huart1.Instance = USART1;
     huart1.Init.BaudRate = 115200;
@@ -219,6 +236,32 @@ static void MX_USART1_UART_Init( void ){
     huart1.Init.HwFlowCtl = UART_HWCONTROL_NONE;
     huart1.Init.OverSampling = UART_OVERSAMPLING_16;
     HAL_UART_Init(&huart1);
+
+    LpmRegisterPeriph(&uartPeriph, "uart", UartSuspend, UartResume, NULL);
+}
+
+/**
+ * @brief Switches the debugging UART off for low power
+ *
+ * @note TX is held at the idle level by the pull-up, a floating line would be
+ *       read as garbage by the USB adapter.
+ */
+static void UartSuspend( void *context ){
+    /* Let the last character out */
+    while (__HAL_UART_GET_FLAG(&huart1, UART_FLAG_TC) == RESET){};
+
+    __HAL_RCC_USART1_CLK_DISABLE();
+    GpioMcuInit(&uartTx, UART_TX, PIN_INPUT, PIN_PUSH_PULL, PIN_PULL_UP, 0);
+    GpioMcuInit(&uartRx, UART_RX, PIN_ANALOGIC, PIN_PUSH_PULL, PIN_NO_PULL, 0);
+}
+
+/**
+ * @brief Restores the debugging UART, its registers are kept while gated
+ */
+static void UartResume( void *context ){
+    __HAL_RCC_USART1_CLK_ENABLE();
+    GpioMcuInit(&uartTx, UART_TX, PIN_ALTERNATE_FCT, PIN_PUSH_PULL, PIN_NO_PULL, GPIO_AF7_USART1);
+    GpioMcuInit(&uartRx, UART_RX, PIN_ALTERNATE_FCT, PIN_PUSH_PULL, PIN_NO_PULL, GPIO_AF7_USART1);
 }
 
 /**
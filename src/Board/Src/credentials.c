@@ -0,0 +1,163 @@
+/**
+ ******************************************************************************
+ * @file      credentials.c
+ * @author    Dean Prince Agbodjan
+ * @brief     LoRaWAN credentials record stored in a dedicated flash section
+ *
+ ******************************************************************************
+ */
+
+/* Includes */
+#include <stdio.h>
+
+#include "credentials.h"
+#include "config.h"
+
+/**
+ * @brief Compile-time conversion of the hex strings in config.h
+ *
+ * @note The string literals are folded by the compiler, so no hex parsing
+ *       code ends up in flash.
+ */
+#define HEX_NIBBLE( c )         ( ( ( c ) <= '9' ) ? ( ( c ) - '0' ) : ( ( ( c ) | 0x20 ) - 'a' + 10 ) )
+#define HEX_BYTE( s, i )        ( uint8_t )( ( ( unsigned )HEX_NIBBLE( ( s )[2 * ( i )] ) << 4 ) | HEX_NIBBLE( ( s )[2 * ( i ) + 1] ) )
+#define HEX_WORD( s, i )        ( uint16_t )( ( ( unsigned )HEX_BYTE( s, 2 * ( i ) ) << 8 ) | HEX_BYTE( s, 2 * ( i ) + 1 ) )
+#define HEX_DWORD( s )          ( ( ( uint32_t )HEX_WORD( s, 0 ) << 16 ) | HEX_WORD( s, 1 ) )
+
+#define HEX_ARRAY_8( s )        { HEX_BYTE( s, 0 ), HEX_BYTE( s, 1 ), HEX_BYTE( s, 2 ), HEX_BYTE( s, 3 ),  \
+                                  HEX_BYTE( s, 4 ), HEX_BYTE( s, 5 ), HEX_BYTE( s, 6 ), HEX_BYTE( s, 7 ) }
+
+#define HEX_ARRAY_16( s )       { HEX_BYTE( s, 0 ),  HEX_BYTE( s, 1 ),  HEX_BYTE( s, 2 ),  HEX_BYTE( s, 3 ),  \
+                                  HEX_BYTE( s, 4 ),  HEX_BYTE( s, 5 ),  HEX_BYTE( s, 6 ),  HEX_BYTE( s, 7 ),  \
+                                  HEX_BYTE( s, 8 ),  HEX_BYTE( s, 9 ),  HEX_BYTE( s, 10 ), HEX_BYTE( s, 11 ), \
+                                  HEX_BYTE( s, 12 ), HEX_BYTE( s, 13 ), HEX_BYTE( s, 14 ), HEX_BYTE( s, 15 ) }
+
+#define HEX_MASK_6( s )         { HEX_WORD( s, 0 ), HEX_WORD( s, 1 ), HEX_WORD( s, 2 ), \
+                                  HEX_WORD( s, 3 ), HEX_WORD( s, 4 ), HEX_WORD( s, 5 ) }
+
+#ifdef LORAWAN_DEVICE_EUI
+#define FLAG_DEV_EUI            CREDENTIALS_HAS_DEV_EUI
+#else
+#define FLAG_DEV_EUI            0
+#endif
+
+#ifdef LORAWAN_APP_EUI
+#define FLAG_JOIN_EUI           CREDENTIALS_HAS_JOIN_EUI
+#else
+#define FLAG_JOIN_EUI           0
+#endif
+
+#ifdef LORAWAN_APP_KEY
+#define FLAG_APP_KEY            CREDENTIALS_HAS_APP_KEY
+#else
+#define FLAG_APP_KEY            0
+#endif
+
+#ifdef LORAWAN_DEVICE_ADDRESS
+#define FLAG_DEV_ADDR           CREDENTIALS_HAS_DEV_ADDR
+#else
+#define FLAG_DEV_ADDR           0
+#endif
+
+#ifdef LORAWAN_NWK_S_KEY
+#define FLAG_NWK_S_KEY          CREDENTIALS_HAS_NWK_S_KEY
+#else
+#define FLAG_NWK_S_KEY          0
+#endif
+
+#ifdef LORAWAN_APP_S_KEY
+#define FLAG_APP_S_KEY          CREDENTIALS_HAS_APP_S_KEY
+#else
+#define FLAG_APP_S_KEY          0
+#endif
+
+#ifdef LORAWAN_CHANNEL_MASK
+#define FLAG_CHANNEL_MASK       CREDENTIALS_HAS_CHANNEL_MASK
+#else
+#define FLAG_CHANNEL_MASK       0
+#endif
+
+/**
+ * Credentials record
+ *
+ * @note Declared volatile so the compiler never folds the build-time values
+ *       into the code: the provisioning tool may have replaced them in the image.
+ */
+__attribute__(( section( ".lorawan_credentials" ), used, aligned( 4 ) ))
+const volatile Credentials_t Credentials = {
+    .Magic       = CREDENTIALS_MAGIC,
+    .Flags       = FLAG_DEV_EUI | FLAG_JOIN_EUI | FLAG_APP_KEY | FLAG_DEV_ADDR |
+                   FLAG_NWK_S_KEY | FLAG_APP_S_KEY | FLAG_CHANNEL_MASK,
+#ifdef LORAWAN_DEVICE_EUI
+    .DevEui      = HEX_ARRAY_8( LORAWAN_DEVICE_EUI ),
+#endif
+#ifdef LORAWAN_APP_EUI
+    .JoinEui     = HEX_ARRAY_8( LORAWAN_APP_EUI ),
+#endif
+#ifdef LORAWAN_APP_KEY
+    .AppKey      = HEX_ARRAY_16( LORAWAN_APP_KEY ),
+#endif
+#ifdef LORAWAN_DEVICE_ADDRESS
+    .DevAddr     = HEX_DWORD( LORAWAN_DEVICE_ADDRESS ),
+#endif
+#ifdef LORAWAN_NWK_S_KEY
+    .NwkSKey     = HEX_ARRAY_16( LORAWAN_NWK_S_KEY ),
+#endif
+#ifdef LORAWAN_APP_S_KEY
+    .AppSKey     = HEX_ARRAY_16( LORAWAN_APP_S_KEY ),
+#endif
+#ifdef LORAWAN_CHANNEL_MASK
+    .ChannelMask = HEX_MASK_6( LORAWAN_CHANNEL_MASK ),
+#endif
+};
+
+/* The marker spelt backwards, a second copy as is would be found by the provisioning tool */
+static const char MagicReversed[CREDENTIALS_MAGIC_SIZE] = "10DERCWL";
+
+/**
+ * @brief Checks the credentials record marker
+ *
+ * @return bool, true when the record is present and readable
+ */
+bool Credentials_IsValid( void )
+{
+    for (int i = 0; i < CREDENTIALS_MAGIC_SIZE; i++)
+    {
+        if (Credentials.Magic[i] != (uint8_t)MagicReversed[CREDENTIALS_MAGIC_SIZE - 1 - i])
+        {
+            printf("Credentials record corrupted\n");
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Fills the OTAA settings from the credentials record
+ *
+ * @param [OUT] settings pointer to lorawan_otaa_settings
+ */
+void Credentials_GetOtaaSettings( struct lorawan_otaa_settings *settings )
+{
+    uint8_t flags = Credentials.Flags;
+
+    settings->device_eui   = (flags & CREDENTIALS_HAS_DEV_EUI) ? (const uint8_t*)Credentials.DevEui : NULL;
+    settings->app_eui      = (flags & CREDENTIALS_HAS_JOIN_EUI) ? (const uint8_t*)Credentials.JoinEui : NULL;
+    settings->app_key      = (flags & CREDENTIALS_HAS_APP_KEY) ? (const uint8_t*)Credentials.AppKey : NULL;
+    settings->channel_mask = (flags & CREDENTIALS_HAS_CHANNEL_MASK) ? (const uint16_t*)Credentials.ChannelMask : NULL;
+}
+
+/**
+ * @brief Fills the ABP settings from the credentials record
+ *
+ * @param [OUT] settings pointer to lorawan_abp_settings
+ */
+void Credentials_GetAbpSettings( struct lorawan_abp_settings *settings )
+{
+    uint8_t flags = Credentials.Flags;
+
+    settings->device_address      = (flags & CREDENTIALS_HAS_DEV_ADDR) ? (const uint32_t*)&Credentials.DevAddr : NULL;
+    settings->network_session_key = (flags & CREDENTIALS_HAS_NWK_S_KEY) ? (const uint8_t*)Credentials.NwkSKey : NULL;
+    settings->app_session_key     = (flags & CREDENTIALS_HAS_APP_S_KEY) ? (const uint8_t*)Credentials.AppSKey : NULL;
+    settings->channel_mask        = (flags & CREDENTIALS_HAS_CHANNEL_MASK) ? (const uint16_t*)Credentials.ChannelMask : NULL;
+}
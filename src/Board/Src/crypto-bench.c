@@ -0,0 +1,200 @@
+/**
+ ******************************************************************************
+ * @file      crypto-bench.c
+ * @author    Dean Prince Agbodjan
+ * @brief     Per-frame cost of the soft secure element AES/CMAC kernels
+ *
+ * @note      Only uses the soft-se aes.h/cmac.h interface, so the same file
+ *            measures the reference kernels and src/Board/Src/soft-se-crypto.c.
+ *            On the target, build with -DLORAWAN_CRYPTO_BENCHMARK=ON and the
+ *            result is printed at boot, in DWT cycles. On a host:
+ *
+ *            cc -O2 -DCRYPTO_BENCH_HOST -Isrc/Board/Inc \
+ *               -Ilib/LoRaMac/LoRaMac-node/src/peripherals/soft-se \
+ *               src/Board/Src/crypto-bench.c src/Board/Src/soft-se-crypto.c
+ *
+ *            (or the soft-se aes.c and cmac.c instead of soft-se-crypto.c)
+ *
+ ******************************************************************************
+ */
+
+/* Includes */
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "crypto-bench.h"
+#include "aes.h"
+#include "cmac.h"
+
+#if defined( CRYPTO_BENCH_HOST )
+#include <time.h>
+#else
+#include "stm32f4xx.h"
+#endif
+
+#define BENCH_ITERATIONS        100
+
+/* Largest US915 DR3 uplink: 13 byte MAC header and 51 byte payload */
+#define BENCH_HEADER_SIZE       13
+#define BENCH_PAYLOAD_SIZE      51
+
+/* FIPS-197 appendix C.1 */
+static const uint8_t AesKey[16] = {
+    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f
+};
+static const uint8_t AesPlain[16] = {
+    0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff
+};
+static const uint8_t AesCipher[16] = {
+    0x69, 0xc4, 0xe0, 0xd8, 0x6a, 0x7b, 0x04, 0x30, 0xd8, 0xcd, 0xb7, 0x80, 0x70, 0xb4, 0xc5, 0x5a
+};
+
+/* RFC 4493 section 4, examples 1 and 3 */
+static const uint8_t CmacKey[16] = {
+    0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae, 0xd2, 0xa6, 0xab, 0xf7, 0x15, 0x88, 0x09, 0xcf, 0x4f, 0x3c
+};
+static const uint8_t CmacMessage[40] = {
+    0x6b, 0xc1, 0xbe, 0xe2, 0x2e, 0x40, 0x9f, 0x96, 0xe9, 0x3d, 0x7e, 0x11, 0x73, 0x93, 0x17, 0x2a,
+    0xae, 0x2d, 0x8a, 0x57, 0x1e, 0x03, 0xac, 0x9c, 0x9e, 0xb7, 0x6f, 0xac, 0x45, 0xaf, 0x8e, 0x51,
+    0x30, 0xc8, 0x1c, 0x46, 0xa3, 0x5c, 0xe4, 0x11
+};
+static const uint8_t CmacEmpty[16] = {
+    0xbb, 0x1d, 0x69, 0x29, 0xe9, 0x59, 0x37, 0x28, 0x7f, 0xa3, 0x7d, 0x12, 0x9b, 0x75, 0x67, 0x46
+};
+static const uint8_t Cmac40[16] = {
+    0xdf, 0xa6, 0x67, 0x47, 0xde, 0x9a, 0xe6, 0x30, 0x30, 0xca, 0x32, 0x61, 0x14, 0x97, 0xc8, 0x27
+};
+
+/* Same storage as the secure element, which keeps both contexts in its NVM data */
+static aes_context AesContext;
+static AES_CMAC_CTX CmacContext;
+
+static uint8_t Frame[BENCH_HEADER_SIZE + BENCH_PAYLOAD_SIZE];
+
+#if defined( CRYPTO_BENCH_HOST )
+static uint32_t CyclesNow( void )
+{
+    struct timespec ts;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ( uint32_t )( ts.tv_sec * 1000000000ull + ts.tv_nsec );
+}
+#define CYCLES_UNIT             "ns"
+#else
+static uint32_t CyclesNow( void )
+{
+    return DWT->CYCCNT;
+}
+#define CYCLES_UNIT             "cycles"
+#endif
+
+/**
+ * @brief Computes a MIC the way the secure element does: B0 block, then the frame
+ */
+static void ComputeMic( const uint8_t *key, const uint8_t *b0, const uint8_t *msg, uint32_t size, uint8_t *mic )
+{
+    AES_CMAC_Init( &CmacContext );
+    AES_CMAC_SetKey( &CmacContext, key );
+    AES_CMAC_Update( &CmacContext, b0, 16 );
+    AES_CMAC_Update( &CmacContext, msg, size );
+    AES_CMAC_Final( mic, &CmacContext );
+}
+
+/**
+ * @brief Encrypts a payload the way the LoRaMac crypto layer does, one Ai block at a time
+ */
+static void CryptPayload( const uint8_t *key, uint8_t *data, uint32_t size )
+{
+    uint8_t a[16] = { 0x01 };
+    uint8_t s[16];
+
+    memset( AesContext.ksch, 0, sizeof( AesContext.ksch ) );
+    aes_set_key( key, 16, &AesContext );
+
+    for( uint32_t offset = 0; offset < size; offset += 16 )
+    {
+        a[15]++;
+        aes_encrypt( a, s, &AesContext );
+
+        for( uint32_t i = 0; ( i < 16 ) && ( offset + i < size ); i++ )
+        {
+            data[offset + i] ^= s[i];
+        }
+    }
+}
+
+static bool CheckVectors( void )
+{
+    uint8_t out[16];
+
+    memset( AesContext.ksch, 0, sizeof( AesContext.ksch ) );
+    aes_set_key( AesKey, 16, &AesContext );
+    aes_encrypt( AesPlain, out, &AesContext );
+    if( memcmp( out, AesCipher, 16 ) != 0 )
+    {
+        printf("AES-128 test vector failed\n");
+        return false;
+    }
+
+    AES_CMAC_Init( &CmacContext );
+    AES_CMAC_SetKey( &CmacContext, CmacKey );
+    AES_CMAC_Final( out, &CmacContext );
+    if( memcmp( out, CmacEmpty, 16 ) != 0 )
+    {
+        printf("AES-CMAC empty message test vector failed\n");
+        return false;
+    }
+
+    /* Fed in odd chunks to exercise the partial block handling */
+    AES_CMAC_Init( &CmacContext );
+    AES_CMAC_SetKey( &CmacContext, CmacKey );
+    AES_CMAC_Update( &CmacContext, CmacMessage, 7 );
+    AES_CMAC_Update( &CmacContext, CmacMessage + 7, 9 );
+    AES_CMAC_Update( &CmacContext, CmacMessage + 16, 24 );
+    AES_CMAC_Final( out, &CmacContext );
+    if( memcmp( out, Cmac40, 16 ) != 0 )
+    {
+        printf("AES-CMAC 40 byte test vector failed\n");
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Checks the kernels against the standard test vectors and prints the
+ *        cost of securing an uplink (payload encryption + MIC)
+ *
+ * @return bool, true when the test vectors pass
+ */
+bool CryptoBench_Run( void )
+{
+    uint8_t b0[16] = { 0x49 };
+    uint8_t mic[16];
+    uint32_t start, first, total;
+
+    if( CheckVectors( ) == false )
+    {
+        return false;
+    }
+
+    /* Two session keys alternate, like AppSKey and NwkSKey on every frame */
+    start = CyclesNow( );
+    CryptPayload( AesPlain, Frame + BENCH_HEADER_SIZE, BENCH_PAYLOAD_SIZE );
+    ComputeMic( CmacKey, b0, Frame, sizeof( Frame ), mic );
+    first = CyclesNow( ) - start;
+
+    start = CyclesNow( );
+    for( int i = 0; i < BENCH_ITERATIONS; i++ )
+    {
+        CryptPayload( AesPlain, Frame + BENCH_HEADER_SIZE, BENCH_PAYLOAD_SIZE );
+        ComputeMic( CmacKey, b0, Frame, sizeof( Frame ), mic );
+    }
+    total = CyclesNow( ) - start;
+
+    printf("Crypto per %d byte uplink: first %lu %s, average %lu %s\n", BENCH_PAYLOAD_SIZE,
+           ( unsigned long )first, CYCLES_UNIT, ( unsigned long )( total / BENCH_ITERATIONS ), CYCLES_UNIT);
+
+    return true;
+}
@@ -0,0 +1,98 @@
+/**
+ ******************************************************************************
+ * @file      gpio-bench.c
+ * @author    Dean Prince Agbodjan
+ * @brief     Cost of the GPIO accessors on the DHT data pin, in DWT cycles
+ *
+ * @note      Compares the HAL calls the driver used to make, the GpioMcu
+ *            driver functions and the inlined register accessors of
+ *            gpio-mcu.h. Build with -DLORAWAN_GPIO_BENCHMARK=ON, the result
+ *            is printed at boot. Best compared between the Debug and Release
+ *            builds: only the inlined accessors keep the same cost.
+ *
+ ******************************************************************************
+ */
+
+/* Includes */
+#include <stdio.h>
+#include <stdint.h>
+
+#include "gpio-bench.h"
+#include "gpio-board.h"
+#include "gpio-mcu.h"
+#include "board-config.h"
+#include "stm32f4xx_hal.h"
+
+#define BENCH_ITERATIONS        1000
+
+/* Unrolled so the loop overhead stays small next to the accessor */
+#define REPEAT_4( x )           x; x; x; x
+
+static uint32_t BenchCycles( uint32_t start )
+{
+    return (DWT->CYCCNT - start) / (BENCH_ITERATIONS * 4);
+}
+
+/**
+ * @brief Times a read and a write of the DHT pin with each accessor
+ *
+ * @note The pin is driven high, the idle level of the DHT bus, so the writes
+ *       produce no edge the sensor would take for a start signal.
+ */
+void GpioBench_Run( void )
+{
+    Gpio_t pin;
+    volatile uint32_t value;
+    uint32_t start, halRead, mcuRead, fastRead, halWrite, mcuWrite, fastWrite;
+
+    GpioMcuInit(&pin, DHT_11_PIN, PIN_OUTPUT, PIN_PUSH_PULL, PIN_NO_PULL, 1);
+
+    start = DWT->CYCCNT;
+    for (int i = 0; i < BENCH_ITERATIONS; i++)
+    {
+        REPEAT_4(value = HAL_GPIO_ReadPin(pin.port, pin.pinIndex));
+    }
+    halRead = BenchCycles(start);
+
+    start = DWT->CYCCNT;
+    for (int i = 0; i < BENCH_ITERATIONS; i++)
+    {
+        REPEAT_4(value = GpioMcuRead(&pin));
+    }
+    mcuRead = BenchCycles(start);
+
+    start = DWT->CYCCNT;
+    for (int i = 0; i < BENCH_ITERATIONS; i++)
+    {
+        REPEAT_4(value = GpioMcuFastRead(&pin));
+    }
+    fastRead = BenchCycles(start);
+
+    start = DWT->CYCCNT;
+    for (int i = 0; i < BENCH_ITERATIONS; i++)
+    {
+        REPEAT_4(HAL_GPIO_WritePin(pin.port, pin.pinIndex, GPIO_PIN_SET));
+    }
+    halWrite = BenchCycles(start);
+
+    start = DWT->CYCCNT;
+    for (int i = 0; i < BENCH_ITERATIONS; i++)
+    {
+        REPEAT_4(GpioMcuWrite(&pin, 1));
+    }
+    mcuWrite = BenchCycles(start);
+
+    start = DWT->CYCCNT;
+    for (int i = 0; i < BENCH_ITERATIONS; i++)
+    {
+        REPEAT_4(GpioMcuFastWrite(&pin, 1));
+    }
+    fastWrite = BenchCycles(start);
+
+    (void)value;
+
+    printf("GPIO read cycles: HAL %lu, GpioMcuRead %lu, GpioMcuFastRead %lu\n",
+           (unsigned long)halRead, (unsigned long)mcuRead, (unsigned long)fastRead);
+    printf("GPIO write cycles: HAL %lu, GpioMcuWrite %lu, GpioMcuFastWrite %lu\n",
+           (unsigned long)halWrite, (unsigned long)mcuWrite, (unsigned long)fastWrite);
+}
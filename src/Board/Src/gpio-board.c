@@ -10,17 +10,34 @@
 /* Includes */
 #include <stdio.h>
 #include <stdint.h>
+#include <stddef.h>
 
 #include "gpio-board.h"
 #include "gpio.h"
+#include "gpio-mcu.h"
+#include "irq-defer.h"
 #include "stm32f4xx.h"
 #include "stm32f4xx_hal.h"
 #include "stm32f4xx_hal_gpio.h"
 #include "stm32f4xx_hal_cortex.h"
 
+/* GPIOA to GPIOH, 0x400 apart */
+#define GPIO_PORT_COUNT         8
+#define GPIO_PORT_INDEX(port)   ((((uint32_t)(port)) - GPIOA_BASE) / 0x400)
+#define GPIO_PORT_CLOCKS        (RCC_AHB1ENR_GPIOAEN | RCC_AHB1ENR_GPIOBEN | RCC_AHB1ENR_GPIOCEN | \
+                                 RCC_AHB1ENR_GPIODEN | RCC_AHB1ENR_GPIOEEN | RCC_AHB1ENR_GPIOHEN)
+
+/* Serial wire debug pins, never parked */
+#define GPIO_SWD_PINS           (GPIO_PIN_13 | GPIO_PIN_14)
+
 /* Variables */
 static uint16_t GpioPinIndex (PinNames pin);
 static Gpio_t *GpioIrq[16];
+static volatile uint32_t GpioIrqCount[16];
+
+/* Pins configured in a mode other than analog, per port */
+static uint16_t GpioClaimedPins[GPIO_PORT_COUNT];
+static void GpioMcuExtiDispatch( uint32_t lines );
 
 /**
  * @brief Initializes the given GPIO object
@@ -76,6 +93,11 @@ void GpioMcuInit( Gpio_t *obj, PinNames pin, PinModes mode, PinConfigs config, P
     obj->pinIndex = GpioPinIndex(pin);
     obj->pull = type;
 
+    if (obj->pin < IOE_0){
+        if (mode == PIN_ANALOGIC) GpioClaimedPins[GPIO_PORT_INDEX(obj->port)] &= ~obj->pinIndex;
+        else GpioClaimedPins[GPIO_PORT_INDEX(obj->port)] |= obj->pinIndex;
+    }
+
     GPIO_ConfigStruct.Pin = obj->pinIndex;
     GPIO_ConfigStruct.Pull = obj->pull;
     
@@ -110,6 +132,41 @@ void GpioMcuInit( Gpio_t *obj, PinNames pin, PinModes mode, PinConfigs config, P
     if ((mode == PIN_OUTPUT) && ((value == 0) || (value == 1))) HAL_GPIO_WritePin(obj->port, obj->pinIndex, value);   
 }
 
+/**
+ * @brief Parks the pins not in use in analog mode and gates the clock of the
+ *        ports left without a pin in use
+ *
+ * @note A pin is in use from its GpioMcuInit in a mode other than analog. The
+ *       clock of a gated port is enabled again by the next GpioMcuInit on it.
+ */
+void GpioMcuParkUnused( void ){
+    static GPIO_TypeDef * const ports[] = { GPIOA, GPIOB, GPIOC, GPIOD, GPIOE, GPIOH };
+    uint32_t clocks = RCC->AHB1ENR | GPIO_PORT_CLOCKS;
+    uint32_t gated = 0;
+
+    /* The mode registers are only written with the port clock on */
+    RCC->AHB1ENR = clocks;
+    (void)RCC->AHB1ENR;
+
+    for (size_t i = 0; i < sizeof(ports) / sizeof(ports[0]); i++){
+        uint32_t index = GPIO_PORT_INDEX(ports[i]);
+        uint16_t unused = ~GpioClaimedPins[index];
+        uint32_t analog = 0;
+
+        if (ports[i] == GPIOA) unused &= ~GPIO_SWD_PINS;
+
+        for (uint32_t pin = 0; pin < 16; pin++){
+            if (unused & (1U << pin)) analog |= 3UL << (pin * 2);
+        }
+        ports[i]->PUPDR &= ~analog;
+        ports[i]->MODER |= analog;
+
+        if (GpioClaimedPins[index] == 0) gated |= RCC_AHB1ENR_GPIOAEN << index;
+    }
+
+    RCC->AHB1ENR = clocks & ~gated;
+}
+
 /**
  * @brief Sets a user defined object pointer
  *
@@ -240,7 +297,7 @@ void GpioMcuRemoveInterrupt( Gpio_t *obj ){
  * @param [IN] value New GPIO output value
  */
 void GpioMcuWrite( Gpio_t *obj, uint32_t value ){
-    HAL_GPIO_WritePin(obj->port, obj->pinIndex, value);
+    GpioMcuFastWrite(obj, value);
 }
 
 /**
@@ -259,7 +316,7 @@ void GpioMcuToggle( Gpio_t *obj ){
  * @return value   Current GPIO input value
  */
 uint32_t GpioMcuRead( Gpio_t *obj ){
-    return (uint32_t)HAL_GPIO_ReadPin(obj->port, obj->pinIndex);
+    return GpioMcuFastRead(obj);
 }
 
 /**
@@ -274,55 +331,69 @@ static uint16_t GpioPinIndex (PinNames pin){
 }
 
 /**
- * @brief Define IRQ handler for EXTI0 - EXTI15
+ * @brief Gets the number of interrupts taken on an EXTI line
  *
- * @param [IN] pin    Pin name ( please look in board-config.h file )
- * @return value  pin number
+ * @param [IN] line EXTI line, the pin number [0..15]
+ * @return value  interrupts since reset
+ */
+uint32_t GpioMcuGetIrqCount( uint8_t line ){
+    return GpioIrqCount[line & 0x0F];
+}
+
+/**
+ * @brief Dispatches the pending EXTI lines of a vector
+ *
+ * @note The pending register is read once and the lines are walked with
+ *       count-trailing-zeros, so the cost only depends on the lines that fired.
+ *
+ * @param [IN] lines  EXTI lines served by the vector
+ */
+static void GpioMcuExtiDispatch( uint32_t lines ){
+    uint32_t pending = EXTI->PR & EXTI->IMR & lines;
+
+    /* Cleared first, an edge during the dispatch raises the interrupt again */
+    EXTI->PR = pending;
+
+    while (pending != 0){
+        uint32_t line = __builtin_ctz(pending);
+        pending &= pending - 1;
+
+        GpioIrqCount[line]++;
+
+        /* The handler runs from PendSV, see irq-defer.c */
+        if ((GpioIrq[line] != NULL) && (GpioIrq[line]->IrqHandler != NULL)){
+            IrqDefer_Post(IrqDefer_ExtiSource(line), GpioIrq[line]->IrqHandler, GpioIrq[line]->Context);
+        }
+    }
+}
+
+/**
+ * @brief Define IRQ handler for EXTI0 - EXTI15
  */
 void EXTI0_IRQHandler(void) {
-    HAL_GPIO_EXTI_IRQHandler(GPIO_PIN_0);
+    GpioMcuExtiDispatch(EXTI_PR_PR0);
 }
 
 void EXTI1_IRQHandler(void) {
-    HAL_GPIO_EXTI_IRQHandler(GPIO_PIN_1);
+    GpioMcuExtiDispatch(EXTI_PR_PR1);
 }
 
 void EXTI2_IRQHandler(void) {
-    HAL_GPIO_EXTI_IRQHandler(GPIO_PIN_2);
+    GpioMcuExtiDispatch(EXTI_PR_PR2);
 }
 
 void EXTI3_IRQHandler(void) {
-    HAL_GPIO_EXTI_IRQHandler(GPIO_PIN_3);
+    GpioMcuExtiDispatch(EXTI_PR_PR3);
 }
 
 void EXTI4_IRQHandler(void) {
-    HAL_GPIO_EXTI_IRQHandler(GPIO_PIN_4);
+    GpioMcuExtiDispatch(EXTI_PR_PR4);
 }
 
 void EXTI9_5_IRQHandler(void) {
-    HAL_GPIO_EXTI_IRQHandler(GPIO_PIN_5);
-    HAL_GPIO_EXTI_IRQHandler(GPIO_PIN_6);
-    HAL_GPIO_EXTI_IRQHandler(GPIO_PIN_7);
-    HAL_GPIO_EXTI_IRQHandler(GPIO_PIN_8);
-    HAL_GPIO_EXTI_IRQHandler(GPIO_PIN_9);
+    GpioMcuExtiDispatch(EXTI_PR_PR5 | EXTI_PR_PR6 | EXTI_PR_PR7 | EXTI_PR_PR8 | EXTI_PR_PR9);
 }
 
 void EXTI15_10_IRQHandler(void) {
-    HAL_GPIO_EXTI_IRQHandler(GPIO_PIN_10);
-    HAL_GPIO_EXTI_IRQHandler(GPIO_PIN_11);
-    HAL_GPIO_EXTI_IRQHandler(GPIO_PIN_12);
-    HAL_GPIO_EXTI_IRQHandler(GPIO_PIN_13);
-    HAL_GPIO_EXTI_IRQHandler(GPIO_PIN_14);
-    HAL_GPIO_EXTI_IRQHandler(GPIO_PIN_15);
+    GpioMcuExtiDispatch(EXTI_PR_PR10 | EXTI_PR_PR11 | EXTI_PR_PR12 | EXTI_PR_PR13 | EXTI_PR_PR14 | EXTI_PR_PR15);
 }
-
-void HAL_GPIO_EXTI_Callback(uint16_t GPIO_Pin){
-    int calback_index;
-    while (GPIO_Pin != 0x00){
-        GPIO_Pin = GPIO_Pin >> 1;
-        calback_index++;
-    }
-    if ((GpioIrq[calback_index] != NULL)&&(GpioIrq[calback_index]->IrqHandler != NULL)){
-        GpioIrq[calback_index]->IrqHandler(GpioIrq[calback_index]->Context);
-    }
-}
\ No newline at end of file
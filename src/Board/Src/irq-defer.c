@@ -0,0 +1,197 @@
+/**
+ ******************************************************************************
+ * @file      irq-defer.c
+ * @author    Dean Prince Agbodjan
+ * @brief     Deferred interrupt work
+ *
+ * @note      Interrupt handlers only timestamp and queue their work, PendSV
+ *            runs it at the lowest exception priority once no interrupt is
+ *            active. Each source has its own single-producer/single-consumer
+ *            ring, so posting needs no lock: the producer only writes Head,
+ *            PendSV only writes Tail.
+ *
+ *            The CRITICAL_SECTION of the LoRaMac stack masks PendSV as well,
+ *            so the deferred handlers keep the exclusion they had as ISRs.
+ *
+ ******************************************************************************
+ */
+
+/* Includes */
+#include <stdio.h>
+#include <stddef.h>
+
+#include "irq-defer.h"
+#include "stm32f4xx.h"
+
+/* Events per source, power of two */
+#define IRQ_DEFER_QUEUE_SIZE    4
+
+typedef struct{
+    IrqDeferHandler_t Handler;
+    void *Context;
+    uint32_t Timestamp;             /* DWT cycles when posted */
+} IrqDeferEvent_t;
+
+typedef struct{
+    volatile uint8_t Head;          /* written by the interrupt only */
+    volatile uint8_t Tail;          /* written by PendSV only */
+    IrqDeferEvent_t Events[IRQ_DEFER_QUEUE_SIZE];
+
+    /* Producer side statistics */
+    uint32_t Posted;
+    uint32_t Dropped;
+    uint8_t MaxDepth;
+} IrqDeferQueue_t;
+
+static IrqDeferQueue_t Queues[IRQ_DEFER_SOURCE_COUNT];
+
+/* Consumer side statistics */
+static uint32_t MaxLatencyCycles;
+static uint32_t MaxHandlerCycles;
+
+/**
+ * @brief Starts the cycle counter and gives PendSV the lowest priority
+ *
+ * @note Called from BoardInitMcu, the one place the DWT cycle counter is
+ *       enabled for every driver and benchmark timing with it.
+ */
+void IrqDefer_Init( void )
+{
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+    NVIC_SetPriority(PendSV_IRQn, (1 << __NVIC_PRIO_BITS) - 1);
+}
+
+/**
+ * @brief Queues work for PendSV, to be called from the interrupt of the source
+ *
+ * @param [IN] source interrupt source
+ * @param [IN] handler work to run
+ * @param [IN] context passed to the handler
+ *
+ * @return bool, false when the queue of the source is full
+ */
+bool IrqDefer_Post( IrqDeferSource_t source, IrqDeferHandler_t handler, void *context )
+{
+    IrqDeferQueue_t *queue = &Queues[source];
+    uint8_t head = queue->Head;
+    uint8_t depth = head - queue->Tail;
+
+    if (depth >= IRQ_DEFER_QUEUE_SIZE)
+    {
+        queue->Dropped++;
+        return false;
+    }
+
+    IrqDeferEvent_t *event = &queue->Events[head & (IRQ_DEFER_QUEUE_SIZE - 1)];
+    event->Handler = handler;
+    event->Context = context;
+    event->Timestamp = DWT->CYCCNT;
+
+    /* The event must be complete before PendSV can see it */
+    __DMB();
+    queue->Head = head + 1;
+
+    queue->Posted++;
+    if (depth + 1 > queue->MaxDepth)
+    {
+        queue->MaxDepth = depth + 1;
+    }
+
+    SCB->ICSR = SCB_ICSR_PENDSVSET_Msk;
+    return true;
+}
+
+/**
+ * @brief Gets the source of an EXTI line
+ *
+ * @param [IN] line EXTI line [0..15]
+ *
+ * @return IrqDeferSource_t, source of the vector serving the line
+ */
+IrqDeferSource_t IrqDefer_ExtiSource( uint8_t line )
+{
+    if (line <= 4)
+    {
+        return IRQ_DEFER_SOURCE_EXTI0 + line;
+    }
+    return (line <= 9) ? IRQ_DEFER_SOURCE_EXTI9_5 : IRQ_DEFER_SOURCE_EXTI15_10;
+}
+
+/**
+ * @brief Gets the deferred work statistics
+ *
+ * @param [OUT] stats pointer to the statistics
+ */
+void IrqDefer_GetStats( IrqDeferStats_t *stats )
+{
+    stats->Posted = 0;
+    stats->Dropped = 0;
+    stats->MaxDepth = 0;
+
+    for (int i = 0; i < IRQ_DEFER_SOURCE_COUNT; i++)
+    {
+        stats->Posted += Queues[i].Posted;
+        stats->Dropped += Queues[i].Dropped;
+        if (Queues[i].MaxDepth > stats->MaxDepth)
+        {
+            stats->MaxDepth = Queues[i].MaxDepth;
+        }
+    }
+
+    stats->MaxLatencyCycles = MaxLatencyCycles;
+    stats->MaxHandlerCycles = MaxHandlerCycles;
+}
+
+/**
+ * @brief Runs the queued work, oldest first across the sources
+ */
+void PendSV_Handler( void )
+{
+    while (1)
+    {
+        IrqDeferQueue_t *oldest = NULL;
+        uint32_t now = DWT->CYCCNT;
+
+        for (int i = 0; i < IRQ_DEFER_SOURCE_COUNT; i++)
+        {
+            IrqDeferQueue_t *queue = &Queues[i];
+
+            if (queue->Head == queue->Tail)
+            {
+                continue;
+            }
+
+            if ((oldest == NULL) ||
+                ((now - queue->Events[queue->Tail & (IRQ_DEFER_QUEUE_SIZE - 1)].Timestamp) >
+                 (now - oldest->Events[oldest->Tail & (IRQ_DEFER_QUEUE_SIZE - 1)].Timestamp)))
+            {
+                oldest = queue;
+            }
+        }
+
+        if (oldest == NULL)
+        {
+            break;
+        }
+
+        /* Copy the event out, the slot is free for the producer once Tail moves */
+        IrqDeferEvent_t event = oldest->Events[oldest->Tail & (IRQ_DEFER_QUEUE_SIZE - 1)];
+        __DMB();
+        oldest->Tail++;
+
+        uint32_t start = DWT->CYCCNT;
+        if (start - event.Timestamp > MaxLatencyCycles)
+        {
+            MaxLatencyCycles = start - event.Timestamp;
+        }
+
+        event.Handler(event.Context);
+
+        if (DWT->CYCCNT - start > MaxHandlerCycles)
+        {
+            MaxHandlerCycles = DWT->CYCCNT - start;
+        }
+    }
+}
@@ -30,14 +30,16 @@
 #include "lorawan.h"
 
 #include "board.h"
+#include "lpm-board.h"
 #include "rtc-board.h"
-#include "sx126x-board.h"
+#include "sx1262-board.h"
 
 #include "../../../lib/LoRaMac/LoRaMac-node/src/apps/LoRaMac/fuota-test-01/firmwareVersion.h"
 #include "Commissioning.h"
 #include "RegionCommon.h"
 #include "LmHandler.h"
 #include "LmhpCompliance.h"
+#include "LmhpClockSync.h"
 #include "LmHandlerMsgDisplay.h"
 #include "NvmDataMgmt.h"
 
@@ -73,6 +75,57 @@
  */
 #define LORAWAN_APP_DATA_BUFFER_MAX_SIZE            242
 
+/*!
+ * Default number of re-sends of a confirmed frame that was not acknowledged
+ */
+#define LORAWAN_DEFAULT_MAX_RETRIES                 2
+
+/*!
+ * Default number of transmissions of an unconfirmed frame
+ */
+#define LORAWAN_DEFAULT_NB_TRANS                    1
+
+/*!
+ * Number of downlink frames the receive queue can hold, must be a power of 2
+ */
+#define LORAWAN_RX_QUEUE_SIZE                       4
+
+/*!
+ * Number of events the application event queue can hold, must be a power of 2
+ */
+#define LORAWAN_EVENT_QUEUE_SIZE                    8
+
+/*!
+ * Delay before a scheduled frame is tried again while the MAC is busy [ms]
+ */
+#define LORAWAN_TX_SCHEDULE_BUSY_DELAY              1000
+
+/*!
+ * Number of downlink SNR samples the link tracker keeps
+ */
+#define LORAWAN_LINK_HISTORY_SIZE                   8
+
+/*!
+ * Default SNR margin kept above the demodulation floor when ADR is off [dB]
+ */
+#define LORAWAN_DEFAULT_LINK_MARGIN_DB              10
+
+/*!
+ * Default number of uplinks between two LinkCheckReq when ADR is off
+ */
+#define LORAWAN_DEFAULT_LINK_CHECK_INTERVAL         8
+
+/*!
+ * Unanswered LinkCheckReq after which the link is lost, the fall back
+ * happens when the next check is due
+ */
+#define LORAWAN_LINK_LOST_CHECKS                    2
+
+/*!
+ * Largest TX power reduction the link tracker applies, in TX_POWER steps of 2 dB
+ */
+#define LORAWAN_LINK_MAX_TX_POWER_STEP              5
+
 /*!
  * LoRaWAN ETSI duty cycle control enable/disable
  *
@@ -173,28 +226,126 @@ static const struct lorawan_abp_settings* AbpSettings = NULL;
 
 static const struct lorawan_otaa_settings* OtaaSettings = NULL;
 
-static uint8_t AppRxDataBuffer[LORAWAN_APP_DATA_BUFFER_MAX_SIZE];
+/*!
+ * Downlink receive queue
+ *
+ * \remark Frames are filled in place by OnRxData and handed to the application
+ *         by pointer. When the queue is full the newest frame is dropped so a
+ *         borrowed frame is never overwritten.
+ */
+static struct lorawan_rx_frame RxQueue[LORAWAN_RX_QUEUE_SIZE];
+static uint32_t RxQueueHead = 0;
+static uint32_t RxQueueTail = 0;
+
+static struct lorawan_rx_stats RxStats;
+
+/*!
+ * Application event queue
+ *
+ * \remark Filled from the LmHandler callbacks, which all run from
+ *         LmHandlerProcess or LmHandlerSend, never from interrupt context.
+ */
+static struct lorawan_event EventQueue[LORAWAN_EVENT_QUEUE_SIZE];
+static uint32_t EventQueueHead = 0;
+static uint32_t EventQueueTail = 0;
+
+/*!
+ * Bounds lorawan_event_wait, runs on the LoRaMac RTC timer list
+ */
+static TimerEvent_t EventWaitTimer;
+static volatile bool EventWaitTimeout = false;
 
-static LmHandlerAppData_t AppRxData =
+static void EventQueuePush( const struct lorawan_event* event );
+static void OnEventWaitTimerEvent( void* context );
+
+/*!
+ * Uplink request in flight
+ */
+typedef struct TxRequest_s
 {
-    .Buffer = AppRxDataBuffer,
-    .BufferSize = 0,
-    .Port = 0,
+    bool Pending;
+    bool RetryPending;
+    bool Scheduled;                     //!< Held back until the duty cycle frees the band
+    int Handle;
+    LmHandlerMsgTypes_t MsgType;
+    LmHandlerAppData_t AppData;
+    uint8_t Attempts;
+    uint32_t AirTimeMs;
+    lorawan_tx_callback_t Callback;
+    void* Context;
+}TxRequest_t;
+
+static uint8_t TxRequestBuffer[LORAWAN_APP_DATA_BUFFER_MAX_SIZE];
+
+static TxRequest_t TxRequest =
+{
+    .AppData.Buffer = TxRequestBuffer,
 };
 
-static bool Debug = true;
+static int TxHandleCounter = 0;
 
-const char* lorawan_default_dev_eui(char* dev_eui)
+static struct lorawan_retry_policy RetryPolicy =
 {
-    uint8_t boardId[8];
+    .max_retries = LORAWAN_DEFAULT_MAX_RETRIES,
+    .lower_datarate = false,
+    .nb_trans = LORAWAN_DEFAULT_NB_TRANS,
+};
 
-    BoardGetUniqueId(boardId);
+static int TxRequestStart( const void* data, uint8_t data_len, uint8_t app_port, bool confirmed,
+                           lorawan_tx_callback_t callback, void* context, bool scheduled );
+static void TxRequestComplete( enum lorawan_tx_status status, LmHandlerTxParams_t* params );
+static void TxRequestRetry( void );
 
-    sprintf(
-        dev_eui, "%02X%02X%02X%02X%02X%02X%02X%02X",
-        boardId[0], boardId[1], boardId[2], boardId[3],
-        boardId[4], boardId[5], boardId[6], boardId[7]
-    );
+/*!
+ * Duty cycle state reported by the MAC when it refuses a request
+ */
+static bool DutyCycleRestricted = false;
+static TimerTime_t DutyCycleFreeAt = 0;
+
+/*!
+ * Wakes the node up when the band of a scheduled frame is free
+ */
+static TimerEvent_t TxScheduleTimer;
+static volatile bool TxScheduleDue = false;
+
+static void TxRequestHold( void );
+static void TxRequestSendScheduled( void );
+static void OnTxScheduleTimerEvent( void* context );
+
+/*!
+ * Link quality tracker, drives the datarate and TX power when ADR is off
+ */
+typedef struct LinkTracker_s
+{
+    int8_t Snr[LORAWAN_LINK_HISTORY_SIZE];
+    uint8_t Samples;
+    uint8_t Next;
+    int16_t LastRssi;
+    uint8_t UplinksSinceCheck;
+    uint8_t UnansweredChecks;
+    int8_t TxPower;
+}LinkTracker_t;
+
+static LinkTracker_t LinkTracker =
+{
+    .TxPower = TX_POWER_0,
+};
+
+static struct lorawan_link_policy LinkPolicy =
+{
+    .margin_db = LORAWAN_DEFAULT_LINK_MARGIN_DB,
+    .link_check_interval = LORAWAN_DEFAULT_LINK_CHECK_INTERVAL,
+};
+
+static void LinkTrackerAddSample( int16_t rssi, int8_t snr, int8_t datarate );
+static void LinkTrackerBeforeUplink( void );
+static void LinkTrackerApply( int8_t datarate, int8_t txPower );
+
+static bool Debug = true;
+
+const uint8_t* lorawan_default_dev_eui(uint8_t* dev_eui)
+{
+    BoardGetUniqueId(dev_eui);
 
     return dev_eui;
 }
@@ -226,6 +377,9 @@ int lorawan_init(LoRaMacRegion_t region)
 
     SX126xIoDbgInit();
 
+    TimerInit( &EventWaitTimer, OnEventWaitTimerEvent );
+    TimerInit( &TxScheduleTimer, OnTxScheduleTimerEvent );
+
     LmHandlerParams.Region = region;
 
     if ( LmHandlerInit( &LmHandlerCallbacks, &LmHandlerParams ) != LORAMAC_HANDLER_SUCCESS )
@@ -240,6 +394,9 @@ int lorawan_init(LoRaMacRegion_t region)
     // initialized and activated.
     LmHandlerPackageRegister( PACKAGE_ID_COMPLIANCE, &LmhpComplianceParams );
 
+    // Application layer clock sync, answers the resyncs forced by the server
+    LmHandlerPackageRegister( PACKAGE_ID_CLOCK_SYNC, NULL );
+
     return 0;
 }
 
@@ -260,6 +417,8 @@ int lorawan_init_otaa(LoRaMacRegion_t region, const struct lorawan_otaa_settings
 
 int lorawan_join()
 {
+    // The join accept is the first downlink, receive it with the best sensitivity
+    SX126xSetRxGainProfile( SX126X_RX_GAIN_BOOSTED );
     LmHandlerJoin( );
     return 0;
 }
@@ -269,6 +428,16 @@ int lorawan_is_joined()
     return (LmHandlerJoinStatus() == LORAMAC_HANDLER_SET);
 }
 
+int lorawan_request_time(void)
+{
+    // DeviceTimeReq goes out with the next uplink, the answer sets the system time
+    if (LmHandlerDeviceTimeReq( ) != LORAMAC_HANDLER_SUCCESS)
+    {
+        return -1;
+    }
+    return 0;
+}
+
 int lorawan_process()
 {
     int sleep = 0;
@@ -276,6 +445,19 @@ int lorawan_process()
     // Processes the LoRaMac events
     LmHandlerProcess( );
 
+    // Re-send a confirmed frame that was not acknowledged
+    if( TxRequest.RetryPending == true )
+    {
+        TxRequestRetry( );
+    }
+
+    // Send the frame held back by the duty cycle now that the band is free
+    if( TxScheduleDue == true )
+    {
+        TxScheduleDue = false;
+        TxRequestSendScheduled( );
+    }
+
     CRITICAL_SECTION_BEGIN( );
     if( IsMacProcessPending == 1 )
     {
@@ -293,6 +475,12 @@ int lorawan_process()
 }
 
 
+bool lorawan_is_idle(void)
+{
+    // Call with the interrupts masked, so nothing can become pending before the sleep
+    return (IsMacProcessPending == 0) && !TxScheduleDue && !TxRequest.RetryPending;
+}
+
 int lorawan_process_timeout_ms(uint32_t timeout_ms)
 {
     uint32_t timeNowTicks = RtcGetTimerValue();
@@ -305,7 +493,7 @@ int lorawan_process_timeout_ms(uint32_t timeout_ms)
     do {
         lorawan_process();
 
-        if (AppRxData.Port) {
+        if (RxQueueHead != RxQueueTail) {
             return 0;
         } else if (joined != lorawan_is_joined()) {
             return 0;
@@ -318,38 +506,326 @@ int lorawan_process_timeout_ms(uint32_t timeout_ms)
 
 int lorawan_send_unconfirmed(const void* data, uint8_t data_len, uint8_t app_port)
 {
-    LmHandlerAppData_t appData;
+    if (lorawan_send(data, data_len, app_port, false, NULL, NULL) < 0) {
+        return -1;
+    }
 
-    appData.Port = app_port;
-    appData.BufferSize = data_len;
-    appData.Buffer = (uint8_t*)data;
+    return 0;
+}
 
-    if (LmHandlerSend(&appData, LORAMAC_HANDLER_UNCONFIRMED_MSG) != LORAMAC_HANDLER_SUCCESS) {
+int lorawan_send_confirmed(const void* data, uint8_t data_len, uint8_t app_port)
+{
+    if (lorawan_send(data, data_len, app_port, true, NULL, NULL) < 0) {
         return -1;
     }
 
     return 0;
 }
 
+int lorawan_send(const void* data, uint8_t data_len, uint8_t app_port, bool confirmed,
+                 lorawan_tx_callback_t callback, void* context)
+{
+    return TxRequestStart(data, data_len, app_port, confirmed, callback, context, false);
+}
+
+int lorawan_send_scheduled(const void* data, uint8_t data_len, uint8_t app_port, bool confirmed,
+                           lorawan_tx_callback_t callback, void* context)
+{
+    return TxRequestStart(data, data_len, app_port, confirmed, callback, context, true);
+}
+
+static int TxRequestStart(const void* data, uint8_t data_len, uint8_t app_port, bool confirmed,
+                          lorawan_tx_callback_t callback, void* context, bool scheduled)
+{
+    struct lorawan_tx_limits limits;
+
+    if (data_len > sizeof(TxRequestBuffer)) {
+        return -1;
+    }
+
+    // LmHandlerSend swaps an oversized frame for an empty one and still reports
+    // success, so the size is checked here where the caller can be told
+    if ((lorawan_get_tx_limits(&limits) == 0) && (data_len > limits.available)) {
+        struct lorawan_event event = {
+            .type = LORAWAN_EVENT_PAYLOAD_TOO_LARGE,
+            .payload.size = data_len,
+            .payload.max_payload = limits.max_payload,
+            .payload.mac_overhead = limits.mac_overhead,
+        };
+        EventQueuePush(&event);
+
+        // Pending MAC commands are in the way, an empty frame sends them out.
+        // A re-send still waiting would carry them as well.
+        if ((data_len <= limits.max_payload) && !TxRequest.Pending && !LmHandlerIsBusy()) {
+            LmHandlerAppData_t flush = {
+                .Port = app_port,
+                .BufferSize = 0,
+                .Buffer = NULL,
+            };
+            LmHandlerSend(&flush, LORAMAC_HANDLER_UNCONFIRMED_MSG);
+        }
+
+        return -1;
+    }
+
+    if (TxRequest.Pending) {
+        if (LmHandlerIsBusy()) {
+            return -1;
+        }
+        // The previous request is waiting for a re-send or for the band, the new
+        // frame supersedes it
+        TxRequestComplete(TxRequest.Scheduled ? LORAWAN_TX_SUPERSEDED : LORAWAN_TX_NOT_ACKED, NULL);
+    }
+
+    memcpy(TxRequest.AppData.Buffer, data, data_len);
+    TxRequest.AppData.BufferSize = data_len;
+    TxRequest.AppData.Port = app_port;
+    TxRequest.MsgType = confirmed ? LORAMAC_HANDLER_CONFIRMED_MSG : LORAMAC_HANDLER_UNCONFIRMED_MSG;
+    TxRequest.Attempts = 1;
+    TxRequest.AirTimeMs = 0;
+    TxRequest.Callback = callback;
+    TxRequest.Context = context;
+    TxRequest.RetryPending = false;
+    TxRequest.Scheduled = false;
+
+    if (scheduled && (lorawan_next_tx_in_ms() > 0)) {
+        // No point waking the radio, the MAC would refuse the frame
+        TxRequestHold();
+    } else {
+        LinkTrackerBeforeUplink();
+
+        if (LmHandlerSend(&TxRequest.AppData, TxRequest.MsgType) != LORAMAC_HANDLER_SUCCESS) {
+            if (!scheduled || (lorawan_next_tx_in_ms() == 0)) {
+                return -1;
+            }
+            TxRequestHold();
+        }
+    }
+
+    if (++TxHandleCounter <= 0) {
+        TxHandleCounter = 1;
+    }
+    TxRequest.Handle = TxHandleCounter;
+    TxRequest.Pending = true;
+
+    return TxRequest.Handle;
+}
+
+uint32_t lorawan_next_tx_in_ms(void)
+{
+    if (DutyCycleRestricted) {
+        int32_t remaining = (int32_t)(DutyCycleFreeAt - TimerGetCurrentTime());
+
+        if (remaining > 0) {
+            return remaining;
+        }
+        DutyCycleRestricted = false;
+    }
+
+    return 0;
+}
+
+int lorawan_get_tx_limits(struct lorawan_tx_limits* limits)
+{
+    LoRaMacTxInfo_t txInfo;
+    LoRaMacStatus_t status;
+
+    // The MAC sizes the frame from the region tables for the current datarate
+    // and dwell time, less the MAC commands waiting for the next uplink
+    status = LoRaMacQueryTxPossible(0, &txInfo);
+    if ((status != LORAMAC_STATUS_OK) && (status != LORAMAC_STATUS_LENGTH_ERROR)) {
+        return -1;
+    }
+
+    limits->datarate = LmHandlerGetCurrentDatarate();
+    // CurrentPossiblePayloadSize is the datarate maximum, the application
+    // data size is what the pending MAC commands leave of it
+    limits->max_payload = txInfo.CurrentPossiblePayloadSize;
+    limits->available = txInfo.MaxPossibleApplicationDataSize;
+    limits->mac_overhead = (limits->max_payload > limits->available) ?
+                           limits->max_payload - limits->available : 0;
+
+    return 0;
+}
+
+uint8_t lorawan_pack_records(struct lorawan_record* records, uint8_t count, uint8_t max_size, uint8_t* frame)
+{
+    uint8_t size = 0;
+
+    while (1) {
+        struct lorawan_record* next = NULL;
+
+        // Most important record left that still fits, the first one on a tie
+        for (uint8_t i = 0; i < count; i++) {
+            if (records[i].packed || (records[i].size > (max_size - size))) {
+                continue;
+            }
+            if ((next == NULL) || (records[i].priority < next->priority)) {
+                next = &records[i];
+            }
+        }
+
+        if (next == NULL) {
+            break;
+        }
+
+        memcpy(&frame[size], next->data, next->size);
+        size += next->size;
+        next->packed = true;
+    }
+
+    return size;
+}
+
+int lorawan_set_retry_policy(const struct lorawan_retry_policy* policy)
+{
+    MibRequestConfirm_t mibReq;
+
+    if ((policy->nb_trans < 1) || (policy->nb_trans > 15)) {
+        return -1;
+    }
+
+    mibReq.Type = MIB_CHANNELS_NB_TRANS;
+    mibReq.Param.ChannelsNbTrans = policy->nb_trans;
+    if (LoRaMacMibSetRequestConfirm(&mibReq) != LORAMAC_STATUS_OK) {
+        return -1;
+    }
+
+    RetryPolicy = *policy;
+
+    return 0;
+}
+
+int lorawan_set_adr(bool enable)
+{
+    if (LmHandlerSetAdrEnable(enable) != LORAMAC_HANDLER_SUCCESS) {
+        return -1;
+    }
+
+    if (!enable) {
+        MibRequestConfirm_t mibReq;
+
+        // Start from the robust default until the tracker has samples. The
+        // tracker takes the power ADR left in the MAC, so Apply resets it
+        memset(&LinkTracker, 0, sizeof(LinkTracker));
+        mibReq.Type = MIB_CHANNELS_TX_POWER;
+        if (LoRaMacMibGetRequestConfirm(&mibReq) == LORAMAC_STATUS_OK) {
+            LinkTracker.TxPower = mibReq.Param.ChannelsTxPower;
+        } else {
+            LinkTracker.TxPower = -1;
+        }
+        LinkTrackerApply(LORAWAN_DEFAULT_DATARATE, TX_POWER_0);
+    }
+
+    return 0;
+}
+
+int lorawan_set_link_policy(const struct lorawan_link_policy* policy)
+{
+    LinkPolicy = *policy;
+
+    return 0;
+}
+
+void lorawan_get_link_stats(struct lorawan_link_stats* stats)
+{
+    stats->rssi = LinkTracker.LastRssi;
+    stats->snr = (LinkTracker.Samples > 0) ?
+                 LinkTracker.Snr[(LinkTracker.Next + LORAWAN_LINK_HISTORY_SIZE - 1) % LORAWAN_LINK_HISTORY_SIZE] : 0;
+    stats->snr_min = stats->snr;
+    for (uint8_t i = 0; i < LinkTracker.Samples; i++) {
+        stats->snr_min = MIN(stats->snr_min, LinkTracker.Snr[i]);
+    }
+    stats->samples = LinkTracker.Samples;
+    stats->datarate = LmHandlerParams.TxDatarate;
+    stats->tx_power = LinkTracker.TxPower;
+    stats->unanswered_checks = LinkTracker.UnansweredChecks;
+}
+
 int lorawan_receive(void* data, uint8_t data_len, uint8_t* app_port)
 {
-    *app_port = AppRxData.Port;
-    if (*app_port == 0) {
+    const struct lorawan_rx_frame* frame = lorawan_rx_borrow();
+
+    if (frame == NULL) {
+        *app_port = 0;
         return -1;
     }
 
-    int receive_length = AppRxData.BufferSize;
+    int receive_length = frame->size;
 
     if (data_len < receive_length) {
         receive_length = data_len;
     }
 
-    memcpy(data, AppRxData.Buffer, receive_length);
-    AppRxData.Port = 0;
+    *app_port = frame->port;
+    memcpy(data, frame->data, receive_length);
+    lorawan_rx_release();
 
     return receive_length;
 }
 
+const struct lorawan_rx_frame* lorawan_rx_borrow(void)
+{
+    if (RxQueueHead == RxQueueTail) {
+        return NULL;
+    }
+
+    return &RxQueue[RxQueueTail & (LORAWAN_RX_QUEUE_SIZE - 1)];
+}
+
+void lorawan_rx_release(void)
+{
+    if (RxQueueHead != RxQueueTail) {
+        RxQueueTail++;
+    }
+}
+
+void lorawan_rx_get_stats(struct lorawan_rx_stats* stats)
+{
+    *stats = RxStats;
+    stats->depth = RxQueueHead - RxQueueTail;
+}
+
+bool lorawan_event_get(struct lorawan_event* event)
+{
+    if (EventQueueHead == EventQueueTail) {
+        return false;
+    }
+
+    *event = EventQueue[EventQueueTail & (LORAWAN_EVENT_QUEUE_SIZE - 1)];
+    EventQueueTail++;
+
+    return true;
+}
+
+int lorawan_event_wait(struct lorawan_event* event, uint32_t timeout_ms)
+{
+    EventWaitTimeout = false;
+    TimerSetValue(&EventWaitTimer, timeout_ms);
+    TimerStart(&EventWaitTimer);
+
+    while (1) {
+        lorawan_process();
+
+        if (lorawan_event_get(event)) {
+            TimerStop(&EventWaitTimer);
+            return 0;
+        }
+
+        if (EventWaitTimeout) {
+            return -1;
+        }
+
+        // Sleep until the radio or an RTC timer needs attention. Interrupts are
+        // masked so one firing after the checks still wakes the core up.
+        CRITICAL_SECTION_BEGIN( );
+        if (lorawan_is_idle() && (EventWaitTimeout == false)) {
+            LpmEnterLowPower( );
+        }
+        CRITICAL_SECTION_END( );
+    }
+}
+
 void lorawan_debug(bool debug)
 {
     Debug = debug;
@@ -372,6 +848,23 @@ static void OnMacProcessNotify( void )
     IsMacProcessPending = 1;
 }
 
+static void EventQueuePush( const struct lorawan_event* event )
+{
+    // Drop the newest event rather than one the application has not seen yet
+    if( ( EventQueueHead - EventQueueTail ) >= LORAWAN_EVENT_QUEUE_SIZE )
+    {
+        return;
+    }
+
+    EventQueue[EventQueueHead & ( LORAWAN_EVENT_QUEUE_SIZE - 1 )] = *event;
+    EventQueueHead++;
+}
+
+static void OnEventWaitTimerEvent( void* context )
+{
+    EventWaitTimeout = true;
+}
+
 static void OnNvmDataChange( LmHandlerNvmContextStates_t state, uint16_t size )
 {
     if (Debug) {
@@ -384,13 +877,13 @@ static void OnNetworkParametersChange( CommissioningParams_t* params )
 {
     MibRequestConfirm_t mibReq;
 
-    const char* device_eui = NULL;
-    const char* app_eui = NULL;
-    const char* device_address = NULL;
-    const char* app_key = NULL;
-    const char* app_session_key = NULL;
-    const char* network_session_key = NULL;
-    const char* channel_mask = NULL;
+    const uint8_t* device_eui = NULL;
+    const uint8_t* app_eui = NULL;
+    const uint32_t* device_address = NULL;
+    const uint8_t* app_key = NULL;
+    const uint8_t* app_session_key = NULL;
+    const uint8_t* network_session_key = NULL;
+    const uint16_t* channel_mask = NULL;
 
     if (OtaaSettings != NULL) {
         params->IsOtaaActivation = 1;
@@ -419,15 +912,7 @@ static void OnNetworkParametersChange( CommissioningParams_t* params )
         LoRaMacMibSetRequestConfirm( &mibReq );
 
         if (device_address != NULL) {
-            params->DevAddr = 0;
-
-            for (int i = 0; i < 4; i++) {
-                int b;
-
-                sscanf(device_address + i * 2, "%2hhx", &b);
-
-                params->DevAddr = (params->DevAddr << 8) | b;
-            }
+            params->DevAddr = *device_address;
         } else {
             // Random seed initialization
             srand1( LmHandlerCallbacks.GetRandomSeed( ) );
@@ -440,118 +925,58 @@ static void OnNetworkParametersChange( CommissioningParams_t* params )
         LoRaMacMibSetRequestConfirm( &mibReq );
     }
 
+    // The MAC layer copies the credentials, they can be handed over straight from flash
     if (device_eui != NULL) {
-        uint8_t deviceEui[8];
-
-        for (int i = 0; i < 8; i++) {
-            int b;
-
-            sscanf(device_eui + i * 2, "%2x", &b);
-
-            deviceEui[i] = b;
-        }
-
         mibReq.Type = MIB_DEV_EUI;
-        mibReq.Param.DevEui = deviceEui;
+        mibReq.Param.DevEui = (uint8_t*)device_eui;
         LoRaMacMibSetRequestConfirm( &mibReq );
         memcpy1( params->DevEui, mibReq.Param.DevEui, 8 );
     }
 
     if (app_eui != NULL) {
-        uint8_t joinEui[8];
-
-        for (int i = 0; i < 8; i++) {
-            int b;
-
-            sscanf(app_eui + i * 2, "%2x", &b);
-
-            joinEui[i] = b;
-        }
-
         mibReq.Type = MIB_JOIN_EUI;
-        mibReq.Param.JoinEui = joinEui;
+        mibReq.Param.JoinEui = (uint8_t*)app_eui;
         LoRaMacMibSetRequestConfirm( &mibReq );
         memcpy1( params->JoinEui, mibReq.Param.JoinEui, 8 );
     }
 
     if (app_key) {
-        uint8_t appKey[16];
-
-        for (int i = 0; i < 16; i++) {
-            int b;
-
-            sscanf(app_key + i * 2, "%2x", &b);
-
-            appKey[i] = b;
-        }
-
         mibReq.Type = MIB_APP_KEY;
-        mibReq.Param.AppKey = appKey;
+        mibReq.Param.AppKey = (uint8_t*)app_key;
         LoRaMacMibSetRequestConfirm( &mibReq );
 
         mibReq.Type = MIB_NWK_KEY;
-        mibReq.Param.NwkKey = appKey;
+        mibReq.Param.NwkKey = (uint8_t*)app_key;
         LoRaMacMibSetRequestConfirm( &mibReq );
     }
 
     if (app_session_key) {
-        uint8_t appSessionKey[16];
-
-        for (int i = 0; i < 16; i++) {
-            int b;
-
-            sscanf(app_session_key + i * 2, "%2x", &b);
-
-            appSessionKey[i] = b;
-        }
-
         mibReq.Type = MIB_APP_S_KEY;
-        mibReq.Param.AppSKey = appSessionKey;
+        mibReq.Param.AppSKey = (uint8_t*)app_session_key;
         LoRaMacMibSetRequestConfirm( &mibReq );
     }
 
     if (network_session_key) {
-        uint8_t networkSessionKey[16];
-
-        for (int i = 0; i < 16; i++) {
-            int b;
-
-            sscanf(network_session_key + i * 2, "%2x", &b);
-
-            networkSessionKey[i] = b;
-        }
-
         mibReq.Type = MIB_F_NWK_S_INT_KEY;
-        mibReq.Param.FNwkSIntKey = networkSessionKey;
+        mibReq.Param.FNwkSIntKey = (uint8_t*)network_session_key;
         LoRaMacMibSetRequestConfirm( &mibReq );
 
         mibReq.Type = MIB_S_NWK_S_INT_KEY;
-        mibReq.Param.SNwkSIntKey = networkSessionKey;
+        mibReq.Param.SNwkSIntKey = (uint8_t*)network_session_key;
         LoRaMacMibSetRequestConfirm( &mibReq );
 
         mibReq.Type = MIB_NWK_S_ENC_KEY;
-        mibReq.Param.NwkSEncKey = networkSessionKey;
+        mibReq.Param.NwkSEncKey = (uint8_t*)network_session_key;
         LoRaMacMibSetRequestConfirm( &mibReq );
     }
 
     if (channel_mask != NULL) {
-        uint16_t channelMask[6];
-
-        for (int i = 0; i < 6; i++) {
-            int b[2];
-
-            sscanf(channel_mask + i * 4 + 0, "%2x", &b[0]);
-            sscanf(channel_mask + i * 4 + 2, "%2x", &b[1]);
-
-            channelMask[i] = (b[0] << 8) | b[1];
-        }
-
         mibReq.Type = MIB_CHANNELS_MASK;
-        mibReq.Param.ChannelsMask = channelMask;
+        mibReq.Param.ChannelsMask = (uint16_t*)channel_mask;
         LoRaMacMibSetRequestConfirm( &mibReq );
         
         mibReq.Type = MIB_CHANNELS_DEFAULT_MASK;
-        mibReq.Param.ChannelsDefaultMask = channelMask;
+        mibReq.Param.ChannelsDefaultMask = (uint16_t*)channel_mask;
         mibReq.Param.NetworkActivation = ACTIVATION_TYPE_OTAA;
         LoRaMacMibSetRequestConfirm( &mibReq );
     }
@@ -566,6 +991,22 @@ static void OnMacMcpsRequest( LoRaMacStatus_t status, McpsReq_t *mcpsReq, TimerT
     if (Debug) {
         DisplayMacMcpsRequestUpdate( status, mcpsReq, nextTxIn );
     }
+
+    if( status == LORAMAC_STATUS_OK )
+    {
+        DutyCycleRestricted = false;
+    }
+    else if( status == LORAMAC_STATUS_DUTYCYCLE_RESTRICTED )
+    {
+        DutyCycleRestricted = true;
+        DutyCycleFreeAt = TimerGetCurrentTime( ) + nextTxIn;
+
+        struct lorawan_event event = {
+            .type = LORAWAN_EVENT_DUTY_CYCLE_BLOCKED,
+            .duty_cycle.next_tx_in_ms = nextTxIn,
+        };
+        EventQueuePush( &event );
+    }
 }
 
 static void OnMacMlmeRequest( LoRaMacStatus_t status, MlmeReq_t *mlmeReq, TimerTime_t nextTxIn )
@@ -573,20 +1014,43 @@ static void OnMacMlmeRequest( LoRaMacStatus_t status, MlmeReq_t *mlmeReq, TimerT
     if (Debug) {
         DisplayMacMlmeRequestUpdate( status, mlmeReq, nextTxIn );
     }
+
+    if( status == LORAMAC_STATUS_DUTYCYCLE_RESTRICTED )
+    {
+        DutyCycleRestricted = true;
+        DutyCycleFreeAt = TimerGetCurrentTime( ) + nextTxIn;
+
+        struct lorawan_event event = {
+            .type = LORAWAN_EVENT_DUTY_CYCLE_BLOCKED,
+            .duty_cycle.next_tx_in_ms = nextTxIn,
+        };
+        EventQueuePush( &event );
+    }
 }
 
 static void OnJoinRequest( LmHandlerJoinParams_t* params )
 {
+    struct lorawan_event event;
+
     if (Debug) {
         DisplayJoinRequestUpdate( params );
     }
 
     if( params->Status == LORAMAC_HANDLER_ERROR )
     {
+        event.type = LORAWAN_EVENT_JOIN_FAILED;
+        EventQueuePush( &event );
+
         LmHandlerJoin( );
     }
     else
     {
+        event.type = LORAWAN_EVENT_JOINED;
+        event.joined.datarate = params->Datarate;
+        EventQueuePush( &event );
+
+        SX126xSetRxGainProfile( SX126X_RX_GAIN_POWER_SAVING );
+
         LmHandlerRequestClass( LORAWAN_DEFAULT_CLASS );
     }
 }
@@ -596,6 +1060,150 @@ static void OnTxData( LmHandlerTxParams_t* params )
     if (Debug) {
         DisplayTxUpdate( params );
     }
+
+    if( params->IsMcpsConfirm == 0 )
+    {
+        return;
+    }
+
+    // Frames sent by the stack itself (class change, compliance) are not tracked
+    if( ( TxRequest.Pending == false ) || ( params->AppData.Port != TxRequest.AppData.Port ) )
+    {
+        struct lorawan_event event = {
+            .type = LORAWAN_EVENT_TX_DONE,
+            .tx = {
+                .handle = 0,
+                .status = ( params->Status == LORAMAC_EVENT_INFO_STATUS_OK ) ? LORAWAN_TX_DONE : LORAWAN_TX_ERROR,
+                .attempts = 1,
+                .channel = params->Channel,
+                .datarate = params->Datarate,
+                .tx_power = params->TxPower,
+                .uplink_counter = params->UplinkCounter,
+                .airtime_ms = SX126xGetTxAirTimeMs( ),
+            },
+        };
+        EventQueuePush( &event );
+        return;
+    }
+
+    TxRequest.AirTimeMs += SX126xGetTxAirTimeMs( );
+
+    if( params->MsgType == LORAMAC_HANDLER_UNCONFIRMED_MSG )
+    {
+        TxRequestComplete( ( params->Status == LORAMAC_EVENT_INFO_STATUS_OK ) ? LORAWAN_TX_DONE : LORAWAN_TX_ERROR, params );
+    }
+    else if( params->AckReceived != 0 )
+    {
+        TxRequestComplete( LORAWAN_TX_ACKED, params );
+    }
+    else if( TxRequest.Attempts <= RetryPolicy.max_retries )
+    {
+        TxRequest.RetryPending = true;
+    }
+    else
+    {
+        TxRequestComplete( LORAWAN_TX_NOT_ACKED, params );
+    }
+}
+
+static void TxRequestRetry( void )
+{
+    TxRequest.RetryPending = false;
+
+    // With ADR off the MAC takes the datarate of each request from the handler
+    if( ( RetryPolicy.lower_datarate == true ) && ( LmHandlerParams.AdrEnable == false ) &&
+        ( LmHandlerParams.TxDatarate > DR_0 ) )
+    {
+        LmHandlerSetTxDatarate( LmHandlerParams.TxDatarate - 1 );
+    }
+
+    TxRequest.Attempts++;
+
+    if( LmHandlerSend( &TxRequest.AppData, TxRequest.MsgType ) != LORAMAC_HANDLER_SUCCESS )
+    {
+        TxRequestComplete( LORAWAN_TX_NOT_ACKED, NULL );
+    }
+}
+
+static void TxRequestComplete( enum lorawan_tx_status status, LmHandlerTxParams_t* params )
+{
+    struct lorawan_tx_result result = {
+        .handle = TxRequest.Handle,
+        .status = status,
+        .attempts = TxRequest.Attempts,
+        .airtime_ms = TxRequest.AirTimeMs,
+    };
+
+    if( params != NULL )
+    {
+        result.channel = params->Channel;
+        result.datarate = params->Datarate;
+        result.tx_power = params->TxPower;
+        result.uplink_counter = params->UplinkCounter;
+    }
+
+    TxRequest.Pending = false;
+    TxRequest.RetryPending = false;
+    TxRequest.Scheduled = false;
+    TimerStop( &TxScheduleTimer );
+
+    struct lorawan_event event = {
+        .type = LORAWAN_EVENT_TX_DONE,
+        .tx = result,
+    };
+    EventQueuePush( &event );
+
+    if( TxRequest.Callback != NULL )
+    {
+        TxRequest.Callback( &result, TxRequest.Context );
+    }
+}
+
+/*!
+ * \brief Keeps the request until the band is free, the MCU sleeps meanwhile
+ */
+static void TxRequestHold( void )
+{
+    TxRequest.Scheduled = true;
+    TimerSetValue( &TxScheduleTimer, lorawan_next_tx_in_ms( ) );
+    TimerStart( &TxScheduleTimer );
+}
+
+static void TxRequestSendScheduled( void )
+{
+    if( ( TxRequest.Pending == false ) || ( TxRequest.Scheduled == false ) )
+    {
+        return;
+    }
+
+    // Still in the receive windows of a frame sent by the stack
+    if( LmHandlerIsBusy( ) == true )
+    {
+        TimerSetValue( &TxScheduleTimer, LORAWAN_TX_SCHEDULE_BUSY_DELAY );
+        TimerStart( &TxScheduleTimer );
+        return;
+    }
+
+    LinkTrackerBeforeUplink( );
+
+    if( LmHandlerSend( &TxRequest.AppData, TxRequest.MsgType ) == LORAMAC_HANDLER_SUCCESS )
+    {
+        TxRequest.Scheduled = false;
+    }
+    else if( lorawan_next_tx_in_ms( ) > 0 )
+    {
+        // Another band the MAC picked is still busy
+        TxRequestHold( );
+    }
+    else
+    {
+        TxRequestComplete( LORAWAN_TX_ERROR, NULL );
+    }
+}
+
+static void OnTxScheduleTimerEvent( void* context )
+{
+    TxScheduleDue = true;
 }
 
 static void OnRxData( LmHandlerAppData_t* appData, LmHandlerRxParams_t* params )
@@ -604,9 +1212,158 @@ static void OnRxData( LmHandlerAppData_t* appData, LmHandlerRxParams_t* params )
         DisplayRxUpdate( appData, params );
     }
 
-    memcpy(AppRxData.Buffer, appData->Buffer, appData->BufferSize);
-    AppRxData.BufferSize = appData->BufferSize;
-    AppRxData.Port = appData->Port;
+    // Every downlink, MAC commands only included, is a link quality sample
+    LinkTrackerAddSample( params->Rssi, params->Snr, params->Datarate );
+
+    // Port 0 frames only carry MAC commands
+    if( appData->Port == 0 )
+    {
+        return;
+    }
+
+    if( ( RxQueueHead - RxQueueTail ) >= LORAWAN_RX_QUEUE_SIZE )
+    {
+        RxStats.dropped++;
+        return;
+    }
+
+    struct lorawan_rx_frame* frame = &RxQueue[RxQueueHead & ( LORAWAN_RX_QUEUE_SIZE - 1 )];
+
+    frame->port = appData->Port;
+    frame->size = MIN( appData->BufferSize, LORAWAN_RX_FRAME_MAX_SIZE );
+    frame->rssi = params->Rssi;
+    frame->snr = params->Snr;
+    frame->timestamp_ms = TimerGetCurrentTime( );
+    memcpy( frame->data, appData->Buffer, frame->size );
+
+    RxQueueHead++;
+    RxStats.received++;
+
+    uint8_t depth = RxQueueHead - RxQueueTail;
+    if( depth > RxStats.max_depth )
+    {
+        RxStats.max_depth = depth;
+    }
+
+    struct lorawan_event event = {
+        .type = LORAWAN_EVENT_RX,
+        .rx = {
+            .port = frame->port,
+            .size = frame->size,
+            .rssi = frame->rssi,
+            .snr = frame->snr,
+        },
+    };
+    EventQueuePush( &event );
+}
+
+/*!
+ * \brief Lowest SNR the LoRa demodulator handles for an uplink datarate [dB]
+ */
+static int8_t LinkDemodFloor( int8_t datarate )
+{
+    // US915 uplinks run SF10..SF7 on DR0..DR3, the other regions SF12..SF7 on DR0..DR5
+    int8_t sf = ( LmHandlerParams.Region == LORAMAC_REGION_US915 ) ? 10 - datarate : 12 - datarate;
+
+    // -7.5 dB at SF7, 2.5 dB lower per spreading factor, rounded down
+    return -( int8_t )( ( 5 * ( sf - 7 ) + 15 + 1 ) / 2 );
+}
+
+static void LinkTrackerAddSample( int16_t rssi, int8_t snr, int8_t datarate )
+{
+    // US915 RX1 downlinks use 500 kHz, 6 dB more noise than the 125 kHz uplinks
+    if( ( LmHandlerParams.Region == LORAMAC_REGION_US915 ) && ( datarate >= DR_8 ) )
+    {
+        snr += 6;
+    }
+
+    LinkTracker.Snr[LinkTracker.Next] = snr;
+    LinkTracker.Next = ( LinkTracker.Next + 1 ) % LORAWAN_LINK_HISTORY_SIZE;
+    LinkTracker.Samples = MIN( LinkTracker.Samples + 1, LORAWAN_LINK_HISTORY_SIZE );
+    LinkTracker.LastRssi = rssi;
+    LinkTracker.UnansweredChecks = 0;
+
+    if( LmHandlerParams.AdrEnable == true )
+    {
+        return;
+    }
+
+    // Size on the worst recent sample
+    int8_t snrMin = snr;
+    for( uint8_t i = 0; i < LinkTracker.Samples; i++ )
+    {
+        snrMin = MIN( snrMin, LinkTracker.Snr[i] );
+    }
+
+    int8_t maxDatarate = ( LmHandlerParams.Region == LORAMAC_REGION_US915 ) ? DR_3 : DR_5;
+    int8_t txDatarate = DR_0;
+    int8_t txPower = TX_POWER_0;
+
+    // Fastest datarate that still keeps the margin
+    for( int8_t dr = maxDatarate; dr > DR_0; dr-- )
+    {
+        if( ( snrMin - LinkDemodFloor( dr ) ) >= LinkPolicy.margin_db )
+        {
+            txDatarate = dr;
+            break;
+        }
+    }
+
+    // Spend the excess margin at the fastest datarate on TX power, 2 dB per step
+    if( txDatarate == maxDatarate )
+    {
+        int16_t excess = snrMin - LinkDemodFloor( txDatarate ) - LinkPolicy.margin_db;
+        txPower = MIN( excess / 2, LORAWAN_LINK_MAX_TX_POWER_STEP );
+    }
+
+    LinkTrackerApply( txDatarate, txPower );
+}
+
+static void LinkTrackerBeforeUplink( void )
+{
+    if( ( LmHandlerParams.AdrEnable == true ) || ( LinkPolicy.link_check_interval == 0 ) )
+    {
+        return;
+    }
+
+    if( ++LinkTracker.UplinksSinceCheck < LinkPolicy.link_check_interval )
+    {
+        return;
+    }
+    LinkTracker.UplinksSinceCheck = 0;
+
+    // The previous checks got no downlink at all: the link got worse, fall back one step
+    if( LinkTracker.UnansweredChecks >= LORAWAN_LINK_LOST_CHECKS )
+    {
+        LinkTracker.UnansweredChecks = 0;
+        LinkTracker.Samples = 0;
+        LinkTracker.Next = 0;
+        LinkTrackerApply( MAX( LmHandlerParams.TxDatarate - 1, DR_0 ), TX_POWER_0 );
+    }
+
+    // Answered in the downlink following the uplink carrying the request
+    LinkTracker.UnansweredChecks++;
+    LmHandlerLinkCheckReq( );
+}
+
+static void LinkTrackerApply( int8_t datarate, int8_t txPower )
+{
+    MibRequestConfirm_t mibReq;
+
+    if( datarate != LmHandlerParams.TxDatarate )
+    {
+        LmHandlerSetTxDatarate( datarate );
+    }
+
+    if( txPower != LinkTracker.TxPower )
+    {
+        mibReq.Type = MIB_CHANNELS_TX_POWER;
+        mibReq.Param.ChannelsTxPower = txPower;
+        if( LoRaMacMibSetRequestConfirm( &mibReq ) == LORAMAC_STATUS_OK )
+        {
+            LinkTracker.TxPower = txPower;
+        }
+    }
 }
 
 static void OnClassChange( DeviceClass_t deviceClass )
@@ -615,6 +1372,12 @@ static void OnClassChange( DeviceClass_t deviceClass )
         DisplayClassUpdate( deviceClass );
     }
 
+    struct lorawan_event event = {
+        .type = LORAWAN_EVENT_CLASS_CHANGED,
+        .device_class = deviceClass,
+    };
+    EventQueuePush( &event );
+
     // Inform the server as soon as possible that the end-device has switched to ClassB
     LmHandlerAppData_t appData =
     {
@@ -652,12 +1415,22 @@ static void OnBeaconStatusChange( LoRaMacHandlerBeaconParams_t* params )
 #if( LMH_SYS_TIME_UPDATE_NEW_API == 1 )
 static void OnSysTimeUpdate( bool isSynchronized, int32_t timeCorrection )
 {
-
+    struct lorawan_event event = {
+        .type = LORAWAN_EVENT_TIME_SYNCED,
+        .time.synchronized = isSynchronized,
+        .time.correction_s = timeCorrection,
+    };
+    EventQueuePush( &event );
 }
 #else
 static void OnSysTimeUpdate( void )
 {
-
+    struct lorawan_event event = {
+        .type = LORAWAN_EVENT_TIME_SYNCED,
+        .time.synchronized = true,
+        .time.correction_s = 0,
+    };
+    EventQueuePush( &event );
 }
 #endif
 
@@ -4,17 +4,31 @@
  * @author    Dean Prince Agbodjan
  * @brief     Target board Low Power Mode implementation
  *
+ * @note      The drivers register suspend and resume hooks, run around every
+ *            low power entry: the peripheral clocks are gated and the pins
+ *            parked in analog mode, so the sleep current is not spent in
+ *            peripherals left running or in floating inputs.
+ *
  ******************************************************************************
  */
 /* includes */
+#include <stddef.h>
+
 #include "stm32f4xx.h"
 #include "stm32f4xx_hal.h"
+#include "board.h"
 #include "lpm-board.h"
+#include "lpm-mcu.h"
+#include "gpio-mcu.h"
 
 /* variables */
 static LpmSetMode_t setMode = LPM_DISABLE;
 static LpmGetMode_t getMode = LPM_SLEEP_MODE;
 
+/* Peripherals switched off in low power */
+static LpmPeriph_t *PeriphList = NULL;
+static bool PeriphsSuspended = false;
+
 /**
  * @brief  This API returns the Low Power Mode selected that will be applied when the system will enter low power mode
  *         if there is no update between the time the mode is read with this API and the time the system enters
@@ -62,6 +76,9 @@ void LpmSetOffMode(LpmId_t id, LpmSetMode_t mode ){
  *         This function shall be called in critical section
  */
 void LpmEnterLowPower( void ){
+    /* Switch off the peripherals, the wake-up sources stay on */
+    BoardDeInitMcu();
+
     if (getMode == LPM_STOP_MODE) 
     {
         LpmEnterStopMode();
@@ -77,6 +94,85 @@ void LpmEnterLowPower( void ){
         LpmEnterSleepMode();
         LpmExitSleepMode();
     }
+
+    LpmResumePeriphs();
+}
+
+/**
+ * @brief Registers the low power hooks of a peripheral, once per peripheral
+ *
+ * @param [IN] periph pointer to the peripheral, must stay valid
+ * @param [IN] name peripheral name
+ * @param [IN] suspend switches the peripheral off
+ * @param [IN] resume restores the peripheral
+ * @param [IN] context passed to the hooks
+ */
+void LpmRegisterPeriph( LpmPeriph_t *periph, const char *name, LpmPeriphHandler_t suspend, LpmPeriphHandler_t resume, void *context ){
+    for (LpmPeriph_t *entry = PeriphList; entry != NULL; entry = entry->Next)
+    {
+        if (entry == periph) return;
+    }
+
+    periph->Name = name;
+    periph->Suspend = suspend;
+    periph->Resume = resume;
+    periph->Context = context;
+    periph->Resumes = 0;
+    periph->ResumeCycles = 0;
+    periph->MaxResumeCycles = 0;
+
+    periph->Next = PeriphList;
+    PeriphList = periph;
+}
+
+/**
+ * @brief Suspends the registered peripherals, then parks the unused pins and
+ *        gates the clocks of the GPIO ports left without a pin in use
+ *
+ * @note A gated GPIO port gets its clock back from GpioMcuInit when one of
+ *       its pins is configured again.
+ */
+void LpmSuspendPeriphs( void ){
+    if (PeriphsSuspended) return;
+
+    for (LpmPeriph_t *periph = PeriphList; periph != NULL; periph = periph->Next)
+    {
+        periph->Suspend(periph->Context);
+    }
+    GpioMcuParkUnused();
+
+    PeriphsSuspended = true;
+}
+
+/**
+ * @brief Resumes the registered peripherals and measures each resume
+ */
+void LpmResumePeriphs( void ){
+    if (!PeriphsSuspended) return;
+
+    for (LpmPeriph_t *periph = PeriphList; periph != NULL; periph = periph->Next)
+    {
+        uint32_t start = DWT->CYCCNT;
+        periph->Resume(periph->Context);
+        periph->ResumeCycles = DWT->CYCCNT - start;
+
+        periph->Resumes++;
+        if (periph->ResumeCycles > periph->MaxResumeCycles)
+        {
+            periph->MaxResumeCycles = periph->ResumeCycles;
+        }
+    }
+
+    PeriphsSuspended = false;
+}
+
+/**
+ * @brief Gets the registered peripherals, with their resume cost
+ *
+ * @return const LpmPeriph_t*, first peripheral of the list
+ */
+const LpmPeriph_t *LpmGetPeriphs( void ){
+    return PeriphList;
 }
 
 /**
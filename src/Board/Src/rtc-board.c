@@ -11,6 +11,8 @@
 #include <stdbool.h>
 
 #include "rtc-board.h"
+#include "rtc-mcu.h"
+#include "irq-defer.h"
 #include "systime.h"
 #include "stm32f4xx.h"
 #include "stm32f4xx_hal.h"
@@ -35,6 +37,10 @@
 #define MINUTES_IN_1HOUR                             (( uint32_t )   60U )
 #define HOURS_IN_1DAY                                (( uint32_t )   24U )
 
+/* Backup register marking a calendar set since the backup domain reset */
+#define RTC_BKP_CALENDAR                             RTC_BKP_DR2
+#define RTC_CALENDAR_MAGIC                           (( uint32_t )0xCA1E2000 )
+
 /* Sub-second mask definition */
 #define ALARM_SUBSECOND_MASK                        ( N_PREDIV_S << RTC_ALRMASSR_MASKSS_Pos )
 
@@ -64,11 +70,14 @@ uint64_t TimeTicks = 0;
 uint64_t RtcGetDateTime(RTC_DateTypeDef *date, RTC_TimeTypeDef *time);
 
 static bool RtcInitialized = false;
+static bool CalendarKept = false;
 
 /**
  * @brief Initializes the RTC timer
  *
- * @note The timer is based on the RTC
+ * @note The timer is based on the RTC. The calendar starts at 2000-01-01 on
+ *       a power up and keeps counting across the resets that leave the
+ *       backup domain alone.
  */
 void RtcInit( void ){
     
@@ -91,28 +100,53 @@ void RtcInit( void ){
     // RTC_HandleStruct.Lock = HAL_UNLOCKED;
     // RTC_HandleStruct.State = HAL_RTC_STATE_RESET;
 
-    if ( HAL_RTC_Init(&RTC_HandleStruct) != HAL_OK ) printf("Error Initializing the RTC\n");
-    
-    RTC_TimeTypeDef RTC_TimeStruct;
-    RTC_DateTypeDef RTC_DateStruct;
-
-    /* Setting up Time and Date */
-    RTC_TimeStruct.Hours = 0;
-    RTC_TimeStruct.Minutes = 0;
-    RTC_TimeStruct.Seconds = 0;
-    RTC_TimeStruct.SubSeconds = 0;
-    RTC_TimeStruct.TimeFormat = 0;
-    RTC_TimeStruct.DayLightSaving = RTC_DAYLIGHTSAVING_NONE;
-    RTC_TimeStruct.StoreOperation = RTC_STOREOPERATION_RESET;
-
-    if ( HAL_RTC_SetTime(&RTC_HandleStruct, &RTC_TimeStruct, RTC_FORMAT_BIN) != HAL_OK ) printf("Error Setting up RTC Time\n");
-    
-    RTC_DateStruct.WeekDay = RTC_WEEKDAY_MONDAY;
-    RTC_DateStruct.Month = RTC_MONTH_JANUARY;
-    RTC_DateStruct.Date = 1;
-    RTC_DateStruct.Year = 0;
-    if ( HAL_RTC_SetDate(&RTC_HandleStruct, &RTC_DateStruct, RTC_FORMAT_BIN) != HAL_OK) printf("Error Setting up RTC Date \n");
-    
+    CalendarKept = (HAL_RTCEx_BKUPRead(&RTC_HandleStruct, RTC_BKP_CALENDAR) == RTC_CALENDAR_MAGIC);
+
+    if (CalendarKept == true){
+        /* Still counting from before the reset, the init mode would stop it
+           and the SysTime offset in DR0/DR1 only holds for this calendar */
+        RTC_HandleStruct.State = HAL_RTC_STATE_READY;
+    }
+    else{
+        if ( HAL_RTC_Init(&RTC_HandleStruct) != HAL_OK ) printf("Error Initializing the RTC\n");
+
+        RTC_TimeTypeDef RTC_TimeStruct;
+        RTC_DateTypeDef RTC_DateStruct;
+
+        /* Setting up Time and Date */
+        RTC_TimeStruct.Hours = 0;
+        RTC_TimeStruct.Minutes = 0;
+        RTC_TimeStruct.Seconds = 0;
+        RTC_TimeStruct.SubSeconds = 0;
+        RTC_TimeStruct.TimeFormat = 0;
+        RTC_TimeStruct.DayLightSaving = RTC_DAYLIGHTSAVING_NONE;
+        RTC_TimeStruct.StoreOperation = RTC_STOREOPERATION_RESET;
+
+        if ( HAL_RTC_SetTime(&RTC_HandleStruct, &RTC_TimeStruct, RTC_FORMAT_BIN) != HAL_OK ) printf("Error Setting up RTC Time\n");
+
+        RTC_DateStruct.WeekDay = RTC_WEEKDAY_MONDAY;
+        RTC_DateStruct.Month = RTC_MONTH_JANUARY;
+        RTC_DateStruct.Date = 1;
+        RTC_DateStruct.Year = 0;
+        if ( HAL_RTC_SetDate(&RTC_HandleStruct, &RTC_DateStruct, RTC_FORMAT_BIN) != HAL_OK) printf("Error Setting up RTC Date \n");
+
+        #ifdef DEBUG_RTC
+        printf("Setting time.........: \n");
+        printf("SubSeconds: %ld\n", RTC_TimeStruct.SubSeconds);
+        printf("Seconds: %d\n", RTC_TimeStruct.Seconds);
+        printf("Minutes: %d\n", RTC_TimeStruct.Minutes);
+        printf("Hours: %d\n", RTC_TimeStruct.Hours);
+
+        printf("WeekDay: %d\n", RTC_DateStruct.WeekDay);
+        printf("Month: %d\n", RTC_DateStruct.Month);
+        printf("Date: %d\n", RTC_DateStruct.Date);
+        printf("Year: %d\n", RTC_DateStruct.Year);
+        #endif
+
+        HAL_RTCEx_BKUPWrite(&RTC_HandleStruct, RTC_BKP_CALENDAR, RTC_CALENDAR_MAGIC);
+        RtcBkupWrite( 0, 0 );
+    }
+
     HAL_RTCEx_EnableBypassShadow(&RTC_HandleStruct);
 
     HAL_NVIC_SetPriority(RTC_Alarm_IRQn, 3, 0);
@@ -120,19 +154,6 @@ void RtcInit( void ){
 
     HAL_RTC_DeactivateAlarm( &RTC_HandleStruct, RTC_ALARM_A );
 
-    #ifdef DEBUG_RTC
-    printf("Setting time.........: \n");
-    printf("SubSeconds: %ld\n", RTC_TimeStruct.SubSeconds);
-    printf("Seconds: %d\n", RTC_TimeStruct.Seconds);
-    printf("Minutes: %d\n", RTC_TimeStruct.Minutes);
-    printf("Hours: %d\n", RTC_TimeStruct.Hours);
-
-    printf("WeekDay: %d\n", RTC_DateStruct.WeekDay);
-    printf("Month: %d\n", RTC_DateStruct.Month);
-    printf("Date: %d\n", RTC_DateStruct.Date);
-    printf("Year: %d\n", RTC_DateStruct.Year);
-    #endif
-
     RtcSetTimerContext();
     RtcInitialized = true;
     }
@@ -470,6 +491,36 @@ void RtcBkupRead ( uint32_t* data0, uint32_t* data1 ){
     *data1 = HAL_RTCEx_BKUPRead(&RTC_HandleStruct, RTC_BKP_DR1);
 }
 
+/**
+ * @brief Tells whether the calendar kept counting across the last reset
+ *
+ * @return bool, false when RtcInit started it from 2000-01-01
+ */
+bool RtcIsCalendarKept( void ){
+    return CalendarKept;
+}
+
+/**
+ * @brief Writes an RTC backup register past the two of RtcBkupWrite
+ *
+ * @param [IN] index register, RTC_BKUP_FIRST_FREE to RTC_BKP_NUMBER - 1
+ * @param [IN] data value to be written
+ */
+void RtcBkupWriteIndex( uint8_t index, uint32_t data ){
+    HAL_RTCEx_BKUPWrite(&RTC_HandleStruct, index, data);
+}
+
+/**
+ * @brief Reads an RTC backup register past the two of RtcBkupRead
+ *
+ * @param [IN] index register, RTC_BKUP_FIRST_FREE to RTC_BKP_NUMBER - 1
+ *
+ * @return uint32_t, register value, 0 after a backup domain reset
+ */
+uint32_t RtcBkupReadIndex( uint8_t index ){
+    return HAL_RTCEx_BKUPRead(&RTC_HandleStruct, index);
+}
+
 /**
  * @brief Returns in ticks the present days and time since epoch
  *
@@ -526,10 +577,17 @@ void RTC_Alarm_IRQHandler (void){
     HAL_RTC_AlarmIRQHandler(&RTC_HandleStruct);
 }
 
+/**
+ * @brief Runs the timer list, deferred from the alarm interrupt
+ */
+static void RtcAlarmDeferred( void *context ){
+    TimerIrqHandler( );
+}
+
 void HAL_RTC_AlarmAEventCallback( RTC_HandleTypeDef *hrtc )
 {
     #ifdef DEBUG_RTC
     printf("RTC HAL_RTC_AlarmAEventCallback\r\n");
     #endif
-    TimerIrqHandler( );
+    IrqDefer_Post( IRQ_DEFER_SOURCE_RTC_ALARM, RtcAlarmDeferred, NULL );
 }
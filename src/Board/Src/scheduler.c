@@ -0,0 +1,245 @@
+/**
+ ******************************************************************************
+ * @file      scheduler.c
+ * @author    Dean Prince Agbodjan
+ * @brief     Cooperative run-to-completion task scheduler
+ *
+ * @note      The task deadlines are folded into a single timer of the LoRaMac
+ *            timer list, which keeps RTC Alarm A on its earliest entry. The
+ *            MCU therefore has one wake source and wakes up once for the
+ *            first deadline, be it a task or the MAC.
+ *
+ ******************************************************************************
+ */
+
+/* Includes */
+#include <stdio.h>
+#include <stddef.h>
+
+#include "scheduler.h"
+#include "lpm-board.h"
+#include "utilities.h"
+
+static SchedulerTask_t *TaskList = NULL;
+
+/* Timer standing for the earliest task deadline in the LoRaMac timer list */
+static TimerEvent_t WakeUpTimer;
+static TimerTime_t WakeUpDeadline;
+static bool WakeUpArmed = false;
+
+static SchedulerStats_t Stats;
+
+static void OnWakeUpTimerEvent( void *context );
+static bool IsTaskDue( const SchedulerTask_t *task, TimerTime_t now, bool early );
+static void ArmWakeUp( TimerTime_t now );
+
+/**
+ * @brief Initializes the scheduler, the LoRaMac timer module must be ready
+ */
+void Scheduler_Init( void )
+{
+    TaskList = NULL;
+    WakeUpArmed = false;
+    TimerInit(&WakeUpTimer, OnWakeUpTimerEvent);
+}
+
+/**
+ * @brief Registers a task, it does not run until started
+ *
+ * @param [IN] task pointer to the task, must stay valid
+ * @param [IN] run task function
+ * @param [IN] context passed to the task function
+ * @param [IN] name task name
+ * @param [IN] slackMs how early the task may run to share a wake-up
+ */
+void Scheduler_AddTask( SchedulerTask_t *task, SchedulerTaskFn_t run, void *context, const char *name, uint32_t slackMs )
+{
+    task->Run = run;
+    task->Context = context;
+    task->Name = name;
+    task->SlackMs = slackMs;
+    task->Active = false;
+    task->Runs = 0;
+    task->MaxLatenessMs = 0;
+
+    task->Next = TaskList;
+    TaskList = task;
+}
+
+/**
+ * @brief Schedules a task
+ *
+ * @param [IN] task pointer to the task
+ * @param [IN] delayMs time to the first run
+ * @param [IN] periodMs time between runs, 0 to run once
+ */
+void Scheduler_Start( SchedulerTask_t *task, uint32_t delayMs, uint32_t periodMs )
+{
+    task->Deadline = TimerGetCurrentTime() + delayMs;
+    task->PeriodMs = periodMs;
+    task->Active = true;
+}
+
+/**
+ * @brief Cancels the next runs of a task
+ *
+ * @param [IN] task pointer to the task
+ */
+void Scheduler_Stop( SchedulerTask_t *task )
+{
+    task->Active = false;
+}
+
+/**
+ * @brief Runs the due tasks and arms the wake-up for the next deadline
+ *
+ * @note Tasks within their slack run along with a due one, so periodic work
+ *       with loose timing shares the wake-ups of the other tasks.
+ */
+void Scheduler_Process( void )
+{
+    TimerTime_t now = TimerGetCurrentTime();
+    bool woken = false;
+
+    for (SchedulerTask_t *task = TaskList; task != NULL; task = task->Next)
+    {
+        if (IsTaskDue(task, now, false))
+        {
+            woken = true;
+            break;
+        }
+    }
+
+    if (woken)
+    {
+        for (SchedulerTask_t *task = TaskList; task != NULL; task = task->Next)
+        {
+            if (!IsTaskDue(task, now, true))
+            {
+                continue;
+            }
+
+            int32_t lateness = (int32_t)(now - task->Deadline);
+            if ((lateness > 0) && ((uint32_t)lateness > task->MaxLatenessMs))
+            {
+                task->MaxLatenessMs = lateness;
+            }
+
+            if (task->PeriodMs == 0)
+            {
+                task->Active = false;
+            } else {
+                /* Keep the period, unless the task fell a whole period behind */
+                task->Deadline += task->PeriodMs;
+                if ((int32_t)(task->Deadline - now) <= 0)
+                {
+                    task->Deadline = now + task->PeriodMs;
+                }
+            }
+
+            task->Runs++;
+            Stats.TaskRuns++;
+            task->Run(task->Context);
+        }
+
+        now = TimerGetCurrentTime();
+    }
+
+    ArmWakeUp(now);
+}
+
+/**
+ * @brief Checks if a task must run now
+ *
+ * @return bool, true when a task deadline has passed
+ */
+bool Scheduler_IsDue( void )
+{
+    TimerTime_t now = TimerGetCurrentTime();
+
+    for (SchedulerTask_t *task = TaskList; task != NULL; task = task->Next)
+    {
+        if (IsTaskDue(task, now, false))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Sleeps until the next interrupt unless some work is pending
+ *
+ * @note The checks run with the interrupts masked, an interrupt firing after
+ *       them still ends the sleep.
+ *
+ * @param [IN] canSleep tells whether the other modules are idle
+ */
+void Scheduler_Sleep( bool (*canSleep)( void ) )
+{
+    CRITICAL_SECTION_BEGIN();
+    if (!Scheduler_IsDue() && canSleep())
+    {
+        LpmEnterLowPower();
+        Stats.WakeUps++;
+    }
+    CRITICAL_SECTION_END();
+}
+
+/**
+ * @brief Gets the scheduler statistics
+ *
+ * @param [OUT] stats pointer to the statistics
+ */
+void Scheduler_GetStats( SchedulerStats_t *stats )
+{
+    *stats = Stats;
+}
+
+static void OnWakeUpTimerEvent( void *context )
+{
+    /* Only there to end the sleep, the tasks run from Scheduler_Process */
+    WakeUpArmed = false;
+}
+
+static bool IsTaskDue( const SchedulerTask_t *task, TimerTime_t now, bool early )
+{
+    if (!task->Active)
+    {
+        return false;
+    }
+
+    return (int32_t)(task->Deadline - now - (early ? task->SlackMs : 0)) <= 0;
+}
+
+static void ArmWakeUp( TimerTime_t now )
+{
+    const SchedulerTask_t *next = NULL;
+
+    for (const SchedulerTask_t *task = TaskList; task != NULL; task = task->Next)
+    {
+        if (task->Active && ((next == NULL) || ((int32_t)(task->Deadline - next->Deadline) < 0)))
+        {
+            next = task;
+        }
+    }
+
+    if (next == NULL)
+    {
+        TimerStop(&WakeUpTimer);
+        WakeUpArmed = false;
+        return;
+    }
+
+    /* The timer list is only touched when the earliest deadline moves */
+    if (WakeUpArmed && (WakeUpDeadline == next->Deadline))
+    {
+        return;
+    }
+
+    int32_t delay = (int32_t)(next->Deadline - now);
+    TimerSetValue(&WakeUpTimer, (delay > 0) ? delay : 1);
+    TimerStart(&WakeUpTimer);
+    WakeUpDeadline = next->Deadline;
+    WakeUpArmed = true;
+}
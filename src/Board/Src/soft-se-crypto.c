@@ -0,0 +1,431 @@
+/**
+ ******************************************************************************
+ * @file      soft-se-crypto.c
+ * @author    Dean Prince Agbodjan
+ * @brief     AES-128 and AES-CMAC kernels for the LoRaMac soft secure element
+ *
+ * @note      Drop-in replacement of soft-se/aes.c and soft-se/cmac.c, selected
+ *            with the LORAWAN_SOFT_SE_FAST_AES CMake option. Blocks are
+ *            processed as 32-bit columns with T-tables instead of bytes, and
+ *            the key schedule and CMAC subkeys of the last few keys are
+ *            cached, since the secure element sets the key on every operation.
+ *
+ *            Define SOFT_SE_AES_TABLES_FULL to use four 1 KB T-tables instead
+ *            of one table plus rotations. On the Cortex-M4 the rotations are
+ *            folded into the EOR instructions, so the gain is small.
+ *
+ ******************************************************************************
+ */
+
+/* Includes */
+#include <stdbool.h>
+#include <string.h>
+
+#include "aes.h"
+#include "cmac.h"
+
+#if defined( AES_DEC_PREKEYED )
+#error "soft-se-crypto.c only implements AES encryption, as used by the LoRaMac crypto layer"
+#endif
+
+/* AES-128 only, the LoRaWAN key size */
+#define AES128_KEY_SIZE         16
+#define AES128_ROUNDS           10
+#define AES128_ROUND_KEYS       ( 4 * ( AES128_ROUNDS + 1 ) )
+
+/* Number of keys whose schedule is kept: AppSKey, NwkSKey, AppKey, NwkKey */
+#define KEY_CACHE_SIZE          4
+
+/* Position of the cache slot index in aes_context.ksch, after the raw key */
+#define CTX_SLOT_INDEX          AES128_KEY_SIZE
+
+/**
+ * @brief Compile-time construction of the tables from the S-box
+ */
+#define XTIME( x )              ( ( ( ( x ) << 1 ) ^ ( ( ( x ) & 0x80 ) ? 0x1b : 0x00 ) ) & 0xff )
+#define TE0( s )                ( ( uint32_t )XTIME( s ) | ( ( uint32_t )( s ) << 8 ) | \
+                                  ( ( uint32_t )( s ) << 16 ) | ( ( uint32_t )( XTIME( s ) ^ ( s ) ) << 24 ) )
+#define TE1( s )                ( ( TE0( s ) << 8 ) | ( TE0( s ) >> 24 ) )
+#define TE2( s )                ( ( TE0( s ) << 16 ) | ( TE0( s ) >> 16 ) )
+#define TE3( s )                ( ( TE0( s ) << 24 ) | ( TE0( s ) >> 8 ) )
+
+#define SBOX_TABLE( f ) { \
+    f( 0x63 ), f( 0x7c ), f( 0x77 ), f( 0x7b ), f( 0xf2 ), f( 0x6b ), f( 0x6f ), f( 0xc5 ), \
+    f( 0x30 ), f( 0x01 ), f( 0x67 ), f( 0x2b ), f( 0xfe ), f( 0xd7 ), f( 0xab ), f( 0x76 ), \
+    f( 0xca ), f( 0x82 ), f( 0xc9 ), f( 0x7d ), f( 0xfa ), f( 0x59 ), f( 0x47 ), f( 0xf0 ), \
+    f( 0xad ), f( 0xd4 ), f( 0xa2 ), f( 0xaf ), f( 0x9c ), f( 0xa4 ), f( 0x72 ), f( 0xc0 ), \
+    f( 0xb7 ), f( 0xfd ), f( 0x93 ), f( 0x26 ), f( 0x36 ), f( 0x3f ), f( 0xf7 ), f( 0xcc ), \
+    f( 0x34 ), f( 0xa5 ), f( 0xe5 ), f( 0xf1 ), f( 0x71 ), f( 0xd8 ), f( 0x31 ), f( 0x15 ), \
+    f( 0x04 ), f( 0xc7 ), f( 0x23 ), f( 0xc3 ), f( 0x18 ), f( 0x96 ), f( 0x05 ), f( 0x9a ), \
+    f( 0x07 ), f( 0x12 ), f( 0x80 ), f( 0xe2 ), f( 0xeb ), f( 0x27 ), f( 0xb2 ), f( 0x75 ), \
+    f( 0x09 ), f( 0x83 ), f( 0x2c ), f( 0x1a ), f( 0x1b ), f( 0x6e ), f( 0x5a ), f( 0xa0 ), \
+    f( 0x52 ), f( 0x3b ), f( 0xd6 ), f( 0xb3 ), f( 0x29 ), f( 0xe3 ), f( 0x2f ), f( 0x84 ), \
+    f( 0x53 ), f( 0xd1 ), f( 0x00 ), f( 0xed ), f( 0x20 ), f( 0xfc ), f( 0xb1 ), f( 0x5b ), \
+    f( 0x6a ), f( 0xcb ), f( 0xbe ), f( 0x39 ), f( 0x4a ), f( 0x4c ), f( 0x58 ), f( 0xcf ), \
+    f( 0xd0 ), f( 0xef ), f( 0xaa ), f( 0xfb ), f( 0x43 ), f( 0x4d ), f( 0x33 ), f( 0x85 ), \
+    f( 0x45 ), f( 0xf9 ), f( 0x02 ), f( 0x7f ), f( 0x50 ), f( 0x3c ), f( 0x9f ), f( 0xa8 ), \
+    f( 0x51 ), f( 0xa3 ), f( 0x40 ), f( 0x8f ), f( 0x92 ), f( 0x9d ), f( 0x38 ), f( 0xf5 ), \
+    f( 0xbc ), f( 0xb6 ), f( 0xda ), f( 0x21 ), f( 0x10 ), f( 0xff ), f( 0xf3 ), f( 0xd2 ), \
+    f( 0xcd ), f( 0x0c ), f( 0x13 ), f( 0xec ), f( 0x5f ), f( 0x97 ), f( 0x44 ), f( 0x17 ), \
+    f( 0xc4 ), f( 0xa7 ), f( 0x7e ), f( 0x3d ), f( 0x64 ), f( 0x5d ), f( 0x19 ), f( 0x73 ), \
+    f( 0x60 ), f( 0x81 ), f( 0x4f ), f( 0xdc ), f( 0x22 ), f( 0x2a ), f( 0x90 ), f( 0x88 ), \
+    f( 0x46 ), f( 0xee ), f( 0xb8 ), f( 0x14 ), f( 0xde ), f( 0x5e ), f( 0x0b ), f( 0xdb ), \
+    f( 0xe0 ), f( 0x32 ), f( 0x3a ), f( 0x0a ), f( 0x49 ), f( 0x06 ), f( 0x24 ), f( 0x5c ), \
+    f( 0xc2 ), f( 0xd3 ), f( 0xac ), f( 0x62 ), f( 0x91 ), f( 0x95 ), f( 0xe4 ), f( 0x79 ), \
+    f( 0xe7 ), f( 0xc8 ), f( 0x37 ), f( 0x6d ), f( 0x8d ), f( 0xd5 ), f( 0x4e ), f( 0xa9 ), \
+    f( 0x6c ), f( 0x56 ), f( 0xf4 ), f( 0xea ), f( 0x65 ), f( 0x7a ), f( 0xae ), f( 0x08 ), \
+    f( 0xba ), f( 0x78 ), f( 0x25 ), f( 0x2e ), f( 0x1c ), f( 0xa6 ), f( 0xb4 ), f( 0xc6 ), \
+    f( 0xe8 ), f( 0xdd ), f( 0x74 ), f( 0x1f ), f( 0x4b ), f( 0xbd ), f( 0x8b ), f( 0x8a ), \
+    f( 0x70 ), f( 0x3e ), f( 0xb5 ), f( 0x66 ), f( 0x48 ), f( 0x03 ), f( 0xf6 ), f( 0x0e ), \
+    f( 0x61 ), f( 0x35 ), f( 0x57 ), f( 0xb9 ), f( 0x86 ), f( 0xc1 ), f( 0x1d ), f( 0x9e ), \
+    f( 0xe1 ), f( 0xf8 ), f( 0x98 ), f( 0x11 ), f( 0x69 ), f( 0xd9 ), f( 0x8e ), f( 0x94 ), \
+    f( 0x9b ), f( 0x1e ), f( 0x87 ), f( 0xe9 ), f( 0xce ), f( 0x55 ), f( 0x28 ), f( 0xdf ), \
+    f( 0x8c ), f( 0xa1 ), f( 0x89 ), f( 0x0d ), f( 0xbf ), f( 0xe6 ), f( 0x42 ), f( 0x68 ), \
+    f( 0x41 ), f( 0x99 ), f( 0x2d ), f( 0x0f ), f( 0xb0 ), f( 0x54 ), f( 0xbb ), f( 0x16 ) }
+
+#define ROTL8( x )              ( ( ( x ) << 8 ) | ( ( x ) >> 24 ) )
+#define ROTL16( x )             ( ( ( x ) << 16 ) | ( ( x ) >> 16 ) )
+#define ROTL24( x )             ( ( ( x ) << 24 ) | ( ( x ) >> 8 ) )
+
+/*
+ * Columns are little-endian words, row 0 in the low byte. Te0 holds the
+ * MixColumns contribution of S-box(x) on row 0, {02, 01, 01, 03}; the other
+ * rows are the same column rotated.
+ */
+static const uint32_t Te0[256] = SBOX_TABLE( TE0 );
+
+#if defined( SOFT_SE_AES_TABLES_FULL )
+static const uint32_t Te1[256] = SBOX_TABLE( TE1 );
+static const uint32_t Te2[256] = SBOX_TABLE( TE2 );
+static const uint32_t Te3[256] = SBOX_TABLE( TE3 );
+
+#define TE_ROW1( x )            Te1[x]
+#define TE_ROW2( x )            Te2[x]
+#define TE_ROW3( x )            Te3[x]
+#else
+#define TE_ROW1( x )            ROTL8( Te0[x] )
+#define TE_ROW2( x )            ROTL16( Te0[x] )
+#define TE_ROW3( x )            ROTL24( Te0[x] )
+#endif
+
+/* S-box(x) is the second byte of Te0[x] */
+#define SBOX( x )               ( ( Te0[x] >> 8 ) & 0xff )
+
+static const uint8_t Rcon[AES128_ROUNDS] = {
+    0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0x1b, 0x36
+};
+
+/**
+ * Expanded key cache entry
+ */
+typedef struct{
+    uint32_t Key[4];
+    uint32_t RoundKeys[AES128_ROUND_KEYS];
+    uint8_t K1[16];
+    uint8_t K2[16];
+    bool Valid;
+    bool HasSubkeys;
+    uint32_t LastUse;
+} KeyCacheSlot_t;
+
+static KeyCacheSlot_t KeyCache[KEY_CACHE_SIZE];
+static uint32_t KeyCacheClock = 0;
+
+static inline uint32_t LoadWord( const uint8_t *p )
+{
+    uint32_t w;
+
+    /* Compiles to a single LDR, the Cortex-M4 handles unaligned accesses */
+    memcpy( &w, p, sizeof( w ) );
+    return w;
+}
+
+static inline void StoreWord( uint8_t *p, uint32_t w )
+{
+    memcpy( p, &w, sizeof( w ) );
+}
+
+static inline uint32_t SubWord( uint32_t w )
+{
+    return SBOX( w & 0xff ) | ( SBOX( ( w >> 8 ) & 0xff ) << 8 ) |
+           ( SBOX( ( w >> 16 ) & 0xff ) << 16 ) | ( SBOX( w >> 24 ) << 24 );
+}
+
+/**
+ * @brief Expands an AES-128 key (FIPS-197 section 5.2)
+ *
+ * @param [OUT] rk round keys
+ * @param [IN] key 4 key words
+ */
+static void ExpandKey( uint32_t *rk, const uint32_t *key )
+{
+    rk[0] = key[0];
+    rk[1] = key[1];
+    rk[2] = key[2];
+    rk[3] = key[3];
+
+    for( int i = 0; i < AES128_ROUNDS; i++ )
+    {
+        /* RotWord is a right rotation with row 0 in the low byte */
+        uint32_t t = rk[3];
+        t = SubWord( ( t >> 8 ) | ( t << 24 ) ) ^ Rcon[i];
+
+        rk[4] = rk[0] ^ t;
+        rk[5] = rk[1] ^ rk[4];
+        rk[6] = rk[2] ^ rk[5];
+        rk[7] = rk[3] ^ rk[6];
+        rk += 4;
+    }
+}
+
+/**
+ * @brief Looks up the cache slot of a key, expanding it on a miss
+ *
+ * @param [IN] key raw AES-128 key
+ * @param [IN] hint slot the key was last seen in
+ *
+ * @return slot index
+ */
+static uint8_t KeyCacheGet( const uint8_t *key, uint8_t hint )
+{
+    uint32_t k[4];
+    uint8_t victim = 0;
+
+    for( int i = 0; i < 4; i++ )
+    {
+        k[i] = LoadWord( key + 4 * i );
+    }
+
+    if( ( hint < KEY_CACHE_SIZE ) && ( KeyCache[hint].Valid == true ) &&
+        ( memcmp( KeyCache[hint].Key, k, sizeof( k ) ) == 0 ) )
+    {
+        KeyCache[hint].LastUse = ++KeyCacheClock;
+        return hint;
+    }
+
+    for( uint8_t i = 0; i < KEY_CACHE_SIZE; i++ )
+    {
+        if( ( KeyCache[i].Valid == true ) && ( memcmp( KeyCache[i].Key, k, sizeof( k ) ) == 0 ) )
+        {
+            KeyCache[i].LastUse = ++KeyCacheClock;
+            return i;
+        }
+
+        /* Least recently used, free slots first */
+        if( ( KeyCache[i].Valid == false ) ||
+            ( ( KeyCache[victim].Valid == true ) && ( KeyCache[i].LastUse < KeyCache[victim].LastUse ) ) )
+        {
+            victim = i;
+        }
+    }
+
+    KeyCacheSlot_t *slot = &KeyCache[victim];
+
+    memcpy( slot->Key, k, sizeof( k ) );
+    ExpandKey( slot->RoundKeys, k );
+    slot->HasSubkeys = false;
+    slot->Valid = true;
+    slot->LastUse = ++KeyCacheClock;
+
+    return victim;
+}
+
+/**
+ * @brief Encrypts one block with an expanded key
+ */
+static void EncryptBlock( const uint32_t *rk, const uint8_t *in, uint8_t *out )
+{
+    uint32_t s0 = LoadWord( in ) ^ rk[0];
+    uint32_t s1 = LoadWord( in + 4 ) ^ rk[1];
+    uint32_t s2 = LoadWord( in + 8 ) ^ rk[2];
+    uint32_t s3 = LoadWord( in + 12 ) ^ rk[3];
+    uint32_t t0, t1, t2, t3;
+
+    for( int round = 1; round < AES128_ROUNDS; round++ )
+    {
+        rk += 4;
+
+        /* SubBytes, ShiftRows and MixColumns in one table lookup per byte */
+        t0 = Te0[s0 & 0xff] ^ TE_ROW1( ( s1 >> 8 ) & 0xff ) ^ TE_ROW2( ( s2 >> 16 ) & 0xff ) ^ TE_ROW3( s3 >> 24 ) ^ rk[0];
+        t1 = Te0[s1 & 0xff] ^ TE_ROW1( ( s2 >> 8 ) & 0xff ) ^ TE_ROW2( ( s3 >> 16 ) & 0xff ) ^ TE_ROW3( s0 >> 24 ) ^ rk[1];
+        t2 = Te0[s2 & 0xff] ^ TE_ROW1( ( s3 >> 8 ) & 0xff ) ^ TE_ROW2( ( s0 >> 16 ) & 0xff ) ^ TE_ROW3( s1 >> 24 ) ^ rk[2];
+        t3 = Te0[s3 & 0xff] ^ TE_ROW1( ( s0 >> 8 ) & 0xff ) ^ TE_ROW2( ( s1 >> 16 ) & 0xff ) ^ TE_ROW3( s2 >> 24 ) ^ rk[3];
+
+        s0 = t0;
+        s1 = t1;
+        s2 = t2;
+        s3 = t3;
+    }
+
+    rk += 4;
+
+    /* Final round has no MixColumns */
+    t0 = SBOX( s0 & 0xff ) | ( SBOX( ( s1 >> 8 ) & 0xff ) << 8 ) | ( SBOX( ( s2 >> 16 ) & 0xff ) << 16 ) | ( SBOX( s3 >> 24 ) << 24 );
+    t1 = SBOX( s1 & 0xff ) | ( SBOX( ( s2 >> 8 ) & 0xff ) << 8 ) | ( SBOX( ( s3 >> 16 ) & 0xff ) << 16 ) | ( SBOX( s0 >> 24 ) << 24 );
+    t2 = SBOX( s2 & 0xff ) | ( SBOX( ( s3 >> 8 ) & 0xff ) << 8 ) | ( SBOX( ( s0 >> 16 ) & 0xff ) << 16 ) | ( SBOX( s1 >> 24 ) << 24 );
+    t3 = SBOX( s3 & 0xff ) | ( SBOX( ( s0 >> 8 ) & 0xff ) << 8 ) | ( SBOX( ( s1 >> 16 ) & 0xff ) << 16 ) | ( SBOX( s2 >> 24 ) << 24 );
+
+    StoreWord( out, t0 ^ rk[0] );
+    StoreWord( out + 4, t1 ^ rk[1] );
+    StoreWord( out + 8, t2 ^ rk[2] );
+    StoreWord( out + 12, t3 ^ rk[3] );
+}
+
+/**
+ * @brief Sets the AES key of a context
+ *
+ * @note The context only keeps the raw key and a cache slot hint, the round
+ *       keys live in the cache so repeated calls with the same key are cheap.
+ *
+ * @param [IN] key raw key
+ * @param [IN] keylen key size in bytes or bits, only 128-bit keys are supported
+ * @param [OUT] ctx AES context
+ *
+ * @return 0 on success, (return_type)-1 on an unsupported key size
+ */
+return_type aes_set_key( const uint8_t key[], length_type keylen, aes_context ctx[1] )
+{
+    if( ( keylen != AES128_KEY_SIZE ) && ( keylen != 128 ) )
+    {
+        ctx->rnd = 0;
+        return ( return_type )-1;
+    }
+
+    memcpy( ctx->ksch, key, AES128_KEY_SIZE );
+    ctx->ksch[CTX_SLOT_INDEX] = KeyCacheGet( key, ctx->ksch[CTX_SLOT_INDEX] );
+    ctx->rnd = AES128_ROUNDS;
+
+    return 0;
+}
+
+/**
+ * @brief Encrypts one 16-byte block
+ *
+ * @param [IN] in plain text block
+ * @param [OUT] out cipher text block, may be the same as in
+ * @param [IN] ctx AES context set up by aes_set_key
+ *
+ * @return 0 on success, (return_type)-1 when no key is set
+ */
+return_type aes_encrypt( const uint8_t in[N_BLOCK], uint8_t out[N_BLOCK], const aes_context ctx[1] )
+{
+    if( ctx->rnd != AES128_ROUNDS )
+    {
+        return ( return_type )-1;
+    }
+
+    /* The slot may have been reused by another key since aes_set_key */
+    uint8_t index = KeyCacheGet( ctx->ksch, ctx->ksch[CTX_SLOT_INDEX] );
+
+    EncryptBlock( KeyCache[index].RoundKeys, in, out );
+
+    return 0;
+}
+
+/**
+ * @brief Doubles a block in GF(2^128) (RFC 4493 section 2.3)
+ */
+static void GfDouble( uint8_t *out, const uint8_t *in )
+{
+    uint8_t carry = in[0] >> 7;
+
+    for( int i = 0; i < 15; i++ )
+    {
+        out[i] = ( uint8_t )( ( in[i] << 1 ) | ( in[i + 1] >> 7 ) );
+    }
+    out[15] = ( uint8_t )( ( in[15] << 1 ) ^ ( carry ? 0x87 : 0x00 ) );
+}
+
+static inline void XorBlock( uint8_t *dst, const uint8_t *src )
+{
+    for( int i = 0; i < 16; i += 4 )
+    {
+        StoreWord( dst + i, LoadWord( dst + i ) ^ LoadWord( src + i ) );
+    }
+}
+
+void AES_CMAC_Init( AES_CMAC_CTX *ctx )
+{
+    memset( ctx->X, 0, sizeof( ctx->X ) );
+    ctx->M_n = 0;
+}
+
+void AES_CMAC_SetKey( AES_CMAC_CTX *ctx, const uint8_t key[AES_CMAC_KEY_LENGTH] )
+{
+    aes_set_key( key, AES_CMAC_KEY_LENGTH, &ctx->rijndael );
+}
+
+void AES_CMAC_Update( AES_CMAC_CTX *ctx, const uint8_t *data, uint32_t len )
+{
+    const uint32_t *rk = KeyCache[KeyCacheGet( ctx->rijndael.ksch, ctx->rijndael.ksch[CTX_SLOT_INDEX] )].RoundKeys;
+
+    /* Complete the buffered block, keep it if it may be the last one */
+    if( ctx->M_n > 0 )
+    {
+        uint32_t n = 16 - ctx->M_n;
+
+        if( n > len )
+        {
+            n = len;
+        }
+        memcpy( ctx->M_last + ctx->M_n, data, n );
+        ctx->M_n += n;
+        data += n;
+        len -= n;
+
+        if( len == 0 )
+        {
+            return;
+        }
+
+        XorBlock( ctx->X, ctx->M_last );
+        EncryptBlock( rk, ctx->X, ctx->X );
+        ctx->M_n = 0;
+    }
+
+    while( len > 16 )
+    {
+        XorBlock( ctx->X, data );
+        EncryptBlock( rk, ctx->X, ctx->X );
+        data += 16;
+        len -= 16;
+    }
+
+    memcpy( ctx->M_last, data, len );
+    ctx->M_n = len;
+}
+
+void AES_CMAC_Final( uint8_t digest[AES_CMAC_DIGEST_LENGTH], AES_CMAC_CTX *ctx )
+{
+    KeyCacheSlot_t *slot = &KeyCache[KeyCacheGet( ctx->rijndael.ksch, ctx->rijndael.ksch[CTX_SLOT_INDEX] )];
+
+    /* Subkeys only depend on the key, derive them once per cached key */
+    if( slot->HasSubkeys == false )
+    {
+        uint8_t l[16] = { 0 };
+
+        EncryptBlock( slot->RoundKeys, l, l );
+        GfDouble( slot->K1, l );
+        GfDouble( slot->K2, slot->K1 );
+        slot->HasSubkeys = true;
+    }
+
+    if( ctx->M_n == 16 )
+    {
+        XorBlock( ctx->M_last, slot->K1 );
+    }
+    else
+    {
+        ctx->M_last[ctx->M_n] = 0x80;
+        memset( ctx->M_last + ctx->M_n + 1, 0, 15 - ctx->M_n );
+        XorBlock( ctx->M_last, slot->K2 );
+    }
+
+    XorBlock( ctx->X, ctx->M_last );
+    EncryptBlock( slot->RoundKeys, ctx->X, digest );
+
+    /* Wipe the chaining state, the key stays in the cache */
+    memset( ctx->X, 0, sizeof( ctx->X ) );
+    memset( ctx->M_last, 0, sizeof( ctx->M_last ) );
+    ctx->M_n = 0;
+}
@@ -11,11 +11,16 @@
 #include <stdbool.h>
 #include "spi-board.h"
 #include "gpio-board.h"
+#include "lpm-mcu.h"
 #include "stm32f4xx.h"
 #include "stm32f4xx_hal.h"
 #include "stm32f4xx_hal_spi.h"
 
 SPI_HandleTypeDef hspi;
+static LpmPeriph_t spiPeriph[2];
+
+static void SpiSuspend( void *context );
+static void SpiResume( void *context );
 
 /* SPI parameters */
 #define SPI_DATASIZE                    8      /* 8 bits or 16 bits */
@@ -77,6 +82,48 @@ void SpiInit( Spi_t *obj, SpiId_t spiId, PinNames mosi, PinNames miso, PinNames
     hspi.Init.CRCPolynomial = 10;
 
     HAL_SPI_Init(&hspi);
+
+    LpmRegisterPeriph(&spiPeriph[obj->SpiId], (spiId == SPI_1) ? "spi1" : "spi2", SpiSuspend, SpiResume, obj);
+}
+
+/**
+ * @brief Switches the SPI off for low power
+ *
+ * @note SCLK, MISO and MOSI are parked, the NSS line of the device stays
+ *       driven high by its driver so the floating bus is ignored.
+ *
+ * @param [IN] context SPI object
+ */
+static void SpiSuspend( void *context ){
+    Spi_t *obj = context;
+
+    /* Let the last transfer end */
+    while(__HAL_SPI_GET_FLAG(&hspi, SPI_FLAG_BSY) != RESET){};
+    __HAL_SPI_DISABLE(&hspi);
+
+    if (obj->SpiId == SPI_1) __HAL_RCC_SPI1_CLK_DISABLE();
+    else __HAL_RCC_SPI2_CLK_DISABLE();
+
+    GpioMcuInit(&obj->Miso, obj->Miso.pin, PIN_ANALOGIC, PIN_PUSH_PULL, PIN_NO_PULL, 0);
+    GpioMcuInit(&obj->Mosi, obj->Mosi.pin, PIN_ANALOGIC, PIN_PUSH_PULL, PIN_NO_PULL, 0);
+    GpioMcuInit(&obj->Sclk, obj->Sclk.pin, PIN_ANALOGIC, PIN_PUSH_PULL, PIN_NO_PULL, 0);
+}
+
+/**
+ * @brief Restores the SPI, its registers are kept while gated and SpiInOut
+ *        enables it again
+ *
+ * @param [IN] context SPI object
+ */
+static void SpiResume( void *context ){
+    Spi_t *obj = context;
+
+    if (obj->SpiId == SPI_1) __HAL_RCC_SPI1_CLK_ENABLE();
+    else __HAL_RCC_SPI2_CLK_ENABLE();
+
+    GpioMcuInit(&obj->Miso, obj->Miso.pin, PIN_ALTERNATE_FCT, PIN_PUSH_PULL, PIN_NO_PULL, GPIO_AF5_SPI1);
+    GpioMcuInit(&obj->Mosi, obj->Mosi.pin, PIN_ALTERNATE_FCT, PIN_PUSH_PULL, PIN_NO_PULL, GPIO_AF5_SPI1);
+    GpioMcuInit(&obj->Sclk, obj->Sclk.pin, PIN_ALTERNATE_FCT, PIN_PUSH_PULL, PIN_NO_PULL, GPIO_AF5_SPI1);
 }
 
 /**
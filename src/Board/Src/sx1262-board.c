@@ -24,12 +24,18 @@
  * \author    Gregory Cristian ( Semtech )
  */
 #include <stdlib.h>
+#include <string.h>
 #include "utilities.h"
 #include "board-config.h"
 #include "board.h"
 #include "delay.h"
 #include "radio.h"
-#include "sx126x-board.h"
+#include "rtc-board.h"
+#include "sx1262-board.h"
+#include "gpio-mcu.h"
+#include "lpm-mcu.h"
+
+#include "stm32f4xx.h"
 
 #if defined( USE_RADIO_DEBUG )
 /*!
@@ -52,6 +58,236 @@ static void SX126xDbgPinRxWrite( uint8_t state );
  */
 static RadioOperatingModes_t OperatingMode;
 
+/*!
+ * \brief Radio DIO1 handler registered by the radio driver
+ */
+static DioIrqHandler *RadioDioIrq = NULL;
+
+/*!
+ * \brief Timestamp of the last SetTx and measured on-air time [RTC ticks]
+ */
+static uint32_t TxStartTicks;
+static uint32_t TxAirTimeTicks;
+static volatile bool TxInProgress = false;
+
+/*!
+ * \brief DIO1 interrupt wrapper, timestamps the end of a transmission
+ */
+static void SX126xOnDio1Irq( void* context );
+
+/*!
+ * \brief Sleep configuration bit retaining the radio configuration
+ */
+#define SX126X_SLEEP_WARM_START                     ( 1 << 2 )
+
+/*!
+ * \brief Calibration state of the radio
+ *
+ * \remark Calibration results survive a warm start sleep and are lost on a
+ *         reset or a cold start sleep.
+ */
+static bool CalibrationValid = false;
+static uint8_t CalibrationParams;
+static bool ImageCalibrationValid = false;
+static uint8_t ImageCalibrationBand[2];
+static bool ImageCalibrationCheck = false;
+
+/*!
+ * \brief Wake-up instrumentation, in DWT cycles
+ */
+static uint32_t WakeStartCycles;
+static bool WakeToTxPending = false;
+
+static SX126xPowerStats_t PowerStats;
+
+/*!
+ * \brief Filters the configuration commands made redundant by the cached
+ *        calibration state
+ *
+ * \param [IN] command Command about to be sent
+ * \param [IN] buffer  Command parameters
+ *
+ * \retval send False when the command can be skipped
+ */
+static bool SX126xPowerManagerFilter( RadioCommands_t command, uint8_t *buffer );
+
+/*!
+ * \brief Converts DWT cycles to microseconds
+ */
+static uint32_t SX126xCyclesToUs( uint32_t cycles );
+
+/*!
+ * \brief Last parameters sent with a configuration command
+ *
+ * \remark The configuration is retained in standby and warm start sleep, so a
+ *         command repeating the cached parameters has no effect on the radio.
+ */
+typedef struct SX126xCommandShadow_s
+{
+    RadioCommands_t Command;
+    bool Valid;
+    uint8_t Size;
+    uint8_t Params[9];
+}SX126xCommandShadow_t;
+
+static SX126xCommandShadow_t CommandShadow[] =
+{
+    { .Command = RADIO_SET_PACKETTYPE },
+    { .Command = RADIO_SET_RFFREQUENCY },
+    { .Command = RADIO_SET_MODULATIONPARAMS },
+    { .Command = RADIO_SET_PACKETPARAMS },
+    { .Command = RADIO_SET_PACONFIG },
+    { .Command = RADIO_SET_TXPARAMS },
+    { .Command = RADIO_SET_BUFFERBASEADDRESS },
+    { .Command = RADIO_CFG_DIOIRQ },
+    { .Command = RADIO_SET_REGULATORMODE },
+    { .Command = RADIO_SET_TCXOMODE },
+    { .Command = RADIO_SET_RFSWITCHMODE },
+    { .Command = RADIO_SET_STOPRXTIMERONPREAMBLE },
+    { .Command = RADIO_SET_LORASYMBTIMEOUT },
+};
+
+static SX126xCommandStats_t CommandStats;
+
+/*!
+ * \brief Checks a command against the shadow of the radio configuration
+ *
+ * \param [IN] command Command about to be sent
+ * \param [IN] buffer  Command parameters
+ * \param [IN] size    Size of the parameters
+ *
+ * \retval send False when the radio already holds these parameters
+ */
+static bool SX126xCommandShadowUpdate( RadioCommands_t command, uint8_t *buffer, uint16_t size );
+
+/*!
+ * \brief Forgets the cached configuration, after a reset
+ */
+static void SX126xCommandShadowInvalidate( void );
+
+/*!
+ * \brief Register shadow entry
+ */
+typedef struct SX126xRegisterShadow_s
+{
+    uint16_t Address;
+    bool Retained;                      //!< Kept across a warm start sleep
+    bool Valid;
+    uint8_t Value;
+}SX126xRegisterShadow_t;
+
+/*!
+ * \brief Configuration registers served from RAM once known
+ *
+ * \remark Status registers (random number, frequency error, RTC and event
+ *         control, payload length) are never cached. Neither are the OCP and
+ *         XTA trim registers, rewritten by the chip itself on SetPaConfig and
+ *         on the TCXO or XOSC start. The RX gain is not part of the sleep
+ *         retention list.
+ */
+static SX126xRegisterShadow_t RegisterShadow[] =
+{
+    { .Address = REG_LR_WHITSEEDBASEADDR_MSB,       .Retained = true },
+    { .Address = REG_LR_WHITSEEDBASEADDR_LSB,       .Retained = true },
+    { .Address = REG_LR_CRCSEEDBASEADDR,            .Retained = true },
+    { .Address = REG_LR_CRCSEEDBASEADDR + 1,        .Retained = true },
+    { .Address = REG_LR_CRCPOLYBASEADDR,            .Retained = true },
+    { .Address = REG_LR_CRCPOLYBASEADDR + 1,        .Retained = true },
+    { .Address = REG_LR_SYNCWORDBASEADDRESS,        .Retained = true },
+    { .Address = REG_LR_SYNCWORDBASEADDRESS + 1,    .Retained = true },
+    { .Address = REG_LR_SYNCWORDBASEADDRESS + 2,    .Retained = true },
+    { .Address = REG_LR_SYNCWORDBASEADDRESS + 3,    .Retained = true },
+    { .Address = REG_LR_SYNCWORDBASEADDRESS + 4,    .Retained = true },
+    { .Address = REG_LR_SYNCWORDBASEADDRESS + 5,    .Retained = true },
+    { .Address = REG_LR_SYNCWORDBASEADDRESS + 6,    .Retained = true },
+    { .Address = REG_LR_SYNCWORDBASEADDRESS + 7,    .Retained = true },
+    { .Address = REG_IQ_POLARITY,                   .Retained = true },
+    { .Address = REG_LR_SYNCWORD,                   .Retained = true },
+    { .Address = REG_LR_SYNCWORD + 1,               .Retained = true },
+    { .Address = REG_TX_MODULATION,                 .Retained = true },
+    { .Address = REG_RX_GAIN,                       .Retained = false },
+    { .Address = REG_TX_CLAMP_CFG,                  .Retained = true },
+};
+
+static SX126xRegisterCacheStats_t RegisterCacheStats;
+
+/*!
+ * \brief SX1262 high power PA settings
+ *
+ * \remark Optimal paDutyCycle/hpMax per output power, DS_SX1261-2 table 13-21,
+ *         each reached with a power parameter of +22. Lower powers use the
+ *         next profile up and reduce the power parameter. TX currents are
+ *         typical at 3.3 V: +22 and +14 dBm from the datasheet, +20 and
+ *         +17 dBm interpolated.
+ */
+typedef struct SX126xPaProfile_s
+{
+    int8_t Power;
+    uint8_t PaDutyCycle;
+    uint8_t HpMax;
+    uint16_t TxCurrentMa;
+}SX126xPaProfile_t;
+
+static const SX126xPaProfile_t PaProfiles[] =
+{
+    { .Power = 14, .PaDutyCycle = 0x02, .HpMax = 0x02, .TxCurrentMa = 45 },
+    { .Power = 17, .PaDutyCycle = 0x02, .HpMax = 0x03, .TxCurrentMa = 72 },
+    { .Power = 20, .PaDutyCycle = 0x03, .HpMax = 0x05, .TxCurrentMa = 100 },
+    { .Power = 22, .PaDutyCycle = 0x04, .HpMax = 0x07, .TxCurrentMa = 118 },
+};
+
+#define SX126X_PA_POWER_PARAM_MAX                   22
+#define SX126X_PA_POWER_PARAM_MIN                   -9
+
+/*!
+ * \brief RX gain register values
+ */
+#define SX126X_RX_GAIN_POWER_SAVING_VALUE           0x94
+#define SX126X_RX_GAIN_BOOSTED_VALUE                0x96
+
+/*!
+ * \brief Selected power profile
+ */
+static const SX126xPaProfile_t *PaProfile = NULL;
+static int8_t PaPowerParam;
+static int8_t TxPower;
+static SX126xRxGain_t RxGain = SX126X_RX_GAIN_POWER_SAVING;
+
+/*!
+ * \brief Finds the shadow entry of a register
+ *
+ * \param [IN] address Register address
+ *
+ * \retval shadow Shadow entry, NULL when the register is not cached
+ */
+static SX126xRegisterShadow_t* SX126xRegisterShadowFind( uint16_t address );
+
+/*!
+ * \brief Forgets the cached register values
+ *
+ * \param [IN] all False to keep the registers retained in warm start sleep
+ */
+static void SX126xRegisterShadowInvalidate( bool all );
+
+/*!
+ * \brief Parks the radio pins the MCU does not need to drive in low power
+ *
+ * \param [IN] context Unused
+ */
+static void SX126xIoSuspend( void *context );
+
+/*!
+ * \brief Drives the parked radio pins again
+ *
+ * \param [IN] context Unused
+ */
+static void SX126xIoResume( void *context );
+
+/*!
+ * Low power hooks of the radio pins
+ */
+static LpmPeriph_t RadioPeriph;
+
 /*!
  * Antenna switch GPIO pins objects
  */
@@ -76,7 +312,191 @@ void SX126xIoInit( void )
 
 void SX126xIoIrqInit( DioIrqHandler dioIrq )
 {
-    GpioSetInterrupt( &SX126x.DIO1, IRQ_RISING_EDGE, IRQ_HIGH_PRIORITY, dioIrq );
+    RadioDioIrq = dioIrq;
+    GpioSetInterrupt( &SX126x.DIO1, IRQ_RISING_EDGE, IRQ_HIGH_PRIORITY, SX126xOnDio1Irq );
+}
+
+static void SX126xOnDio1Irq( void* context )
+{
+    if( TxInProgress == true )
+    {
+        // The first DIO1 event after SetTx is either TxDone or Timeout
+        TxAirTimeTicks = RtcGetTimerValue( ) - TxStartTicks;
+        TxInProgress = false;
+    }
+
+    if( RadioDioIrq != NULL )
+    {
+        RadioDioIrq( context );
+    }
+}
+
+uint32_t SX126xGetTxAirTimeMs( void )
+{
+    return RtcTick2Ms( TxAirTimeTicks );
+}
+
+void SX126xGetPowerStats( SX126xPowerStats_t *stats )
+{
+    *stats = PowerStats;
+}
+
+void SX126xGetCommandStats( SX126xCommandStats_t *stats )
+{
+    *stats = CommandStats;
+}
+
+static bool SX126xCommandShadowUpdate( RadioCommands_t command, uint8_t *buffer, uint16_t size )
+{
+    SX126xCommandShadow_t *shadow = NULL;
+
+    for( uint8_t i = 0; i < ( sizeof( CommandShadow ) / sizeof( CommandShadow[0] ) ); i++ )
+    {
+        if( CommandShadow[i].Command == command )
+        {
+            shadow = &CommandShadow[i];
+            break;
+        }
+    }
+
+    if( ( shadow == NULL ) || ( size > sizeof( shadow->Params ) ) )
+    {
+        return true;
+    }
+
+    if( ( shadow->Valid == true ) && ( shadow->Size == size ) && ( memcmp( shadow->Params, buffer, size ) == 0 ) )
+    {
+        return false;
+    }
+
+    if( command == RADIO_SET_PACKETTYPE )
+    {
+        // Modulation and packet parameters have to be sent again for the new packet type
+        for( uint8_t i = 0; i < ( sizeof( CommandShadow ) / sizeof( CommandShadow[0] ) ); i++ )
+        {
+            if( ( CommandShadow[i].Command == RADIO_SET_MODULATIONPARAMS ) ||
+                ( CommandShadow[i].Command == RADIO_SET_PACKETPARAMS ) )
+            {
+                CommandShadow[i].Valid = false;
+            }
+        }
+    }
+
+    memcpy( shadow->Params, buffer, size );
+    shadow->Size = size;
+    shadow->Valid = true;
+
+    return true;
+}
+
+static void SX126xCommandShadowInvalidate( void )
+{
+    for( uint8_t i = 0; i < ( sizeof( CommandShadow ) / sizeof( CommandShadow[0] ) ); i++ )
+    {
+        CommandShadow[i].Valid = false;
+    }
+}
+
+void SX126xGetRegisterCacheStats( SX126xRegisterCacheStats_t *stats )
+{
+    *stats = RegisterCacheStats;
+}
+
+static SX126xRegisterShadow_t* SX126xRegisterShadowFind( uint16_t address )
+{
+    for( uint8_t i = 0; i < ( sizeof( RegisterShadow ) / sizeof( RegisterShadow[0] ) ); i++ )
+    {
+        if( RegisterShadow[i].Address == address )
+        {
+            return &RegisterShadow[i];
+        }
+    }
+    return NULL;
+}
+
+static void SX126xRegisterShadowInvalidate( bool all )
+{
+    for( uint8_t i = 0; i < ( sizeof( RegisterShadow ) / sizeof( RegisterShadow[0] ) ); i++ )
+    {
+        if( ( all == true ) || ( RegisterShadow[i].Retained == false ) )
+        {
+            RegisterShadow[i].Valid = false;
+        }
+    }
+}
+
+static uint32_t SX126xCyclesToUs( uint32_t cycles )
+{
+    return cycles / ( SystemCoreClock / 1000000 );
+}
+
+static bool SX126xPowerManagerFilter( RadioCommands_t command, uint8_t *buffer )
+{
+    switch( command )
+    {
+        case RADIO_SET_SLEEP:
+            // Always retain the configuration, the driver never re-applies it after a cold start
+            buffer[0] |= SX126X_SLEEP_WARM_START;
+            SX126xRegisterShadowInvalidate( false );
+            break;
+        case RADIO_SET_REGULATORMODE:
+            buffer[0] = BOARD_RADIO_REGULATOR_MODE;
+            break;
+        case RADIO_SET_PACONFIG:
+            // The driver always applies the +22 dBm settings, use the ones of the selected power
+            if( ( PaProfile != NULL ) && ( buffer[2] == 0x00 ) )
+            {
+                buffer[0] = PaProfile->PaDutyCycle;
+                buffer[1] = PaProfile->HpMax;
+            }
+            break;
+        case RADIO_SET_TXPARAMS:
+            if( PaProfile != NULL )
+            {
+                buffer[0] = ( uint8_t )PaPowerParam;
+            }
+            break;
+        case RADIO_CALIBRATE:
+            if( ( CalibrationValid == true ) && ( CalibrationParams == buffer[0] ) )
+            {
+                PowerStats.CalibrationsSkipped++;
+                return false;
+            }
+            CalibrationValid = true;
+            CalibrationParams = buffer[0];
+            break;
+        case RADIO_CALIBRATEIMAGE:
+            if( ( ImageCalibrationValid == true ) &&
+                ( ImageCalibrationBand[0] == buffer[0] ) && ( ImageCalibrationBand[1] == buffer[1] ) )
+            {
+                if( ImageCalibrationCheck == false )
+                {
+                    PowerStats.ImageCalibrationsSkipped++;
+                }
+                return false;
+            }
+            ImageCalibrationValid = true;
+            ImageCalibrationBand[0] = buffer[0];
+            ImageCalibrationBand[1] = buffer[1];
+            break;
+        case RADIO_SET_RFFREQUENCY:
+        {
+            // The driver only calibrates the image for the first frequency it
+            // sets, re-calibrate when a channel falls in another band
+            uint32_t rfFreq = ( ( uint32_t )buffer[0] << 24 ) | ( ( uint32_t )buffer[1] << 16 ) |
+                              ( ( uint32_t )buffer[2] << 8 ) | buffer[3];
+            uint32_t freq = ( uint32_t )( ( ( uint64_t )rfFreq * 15625 ) >> 14 );
+
+            ImageCalibrationCheck = true;
+            SX126xCalibrateImage( freq );
+            ImageCalibrationCheck = false;
+            break;
+        }
+        default:
+            break;
+    }
+
+    return true;
 }
 
 void SX126xIoDeInit( void )
@@ -122,6 +542,23 @@ RadioOperatingModes_t SX126xGetOperatingMode( void )
 
 void SX126xSetOperatingMode( RadioOperatingModes_t mode )
 {
+    if( mode == MODE_TX )
+    {
+        TxStartTicks = RtcGetTimerValue( );
+        TxInProgress = true;
+
+        if( WakeToTxPending == true )
+        {
+            PowerStats.WakeToTxUs = SX126xCyclesToUs( DWT->CYCCNT - WakeStartCycles );
+            PowerStats.WakeToTxMaxUs = MAX( PowerStats.WakeToTxMaxUs, PowerStats.WakeToTxUs );
+            WakeToTxPending = false;
+        }
+    }
+    else if( ( mode != MODE_STDBY_RC ) && ( mode != MODE_STDBY_XOSC ) && ( mode != MODE_FS ) )
+    {
+        // The radio woke up for a reception
+        WakeToTxPending = false;
+    }
     OperatingMode = mode;
 #if defined( USE_RADIO_DEBUG )
     switch( mode )
@@ -151,27 +588,65 @@ void SX126xReset( void )
     //GpioInit( &SX126x.Reset, RADIO_RESET, PIN_ANALOGIC, PIN_PUSH_PULL, PIN_NO_PULL, 0 ); // internal pull-up
     GpioInit( &SX126x.Reset, RADIO_RESET, PIN_OUTPUT, PIN_PUSH_PULL, PIN_NO_PULL, 1 );
     DelayMs( 10 );
+
+    // The reset pin is known from now on
+    LpmRegisterPeriph( &RadioPeriph, "sx1262", SX126xIoSuspend, SX126xIoResume, NULL );
+
+    // Calibration results and configuration are lost
+    CalibrationValid = false;
+    ImageCalibrationValid = false;
+    SX126xCommandShadowInvalidate( );
+    SX126xRegisterShadowInvalidate( true );
+}
+
+/*
+ * NSS stays driven high in low power, a floating NSS would select the radio.
+ * BUSY and DIO1 are radio outputs, DIO1 being the wake-up source.
+ */
+
+static void SX126xIoSuspend( void *context )
+{
+    // The radio pulls NRESET up internally
+    GpioInit( &SX126x.Reset, RADIO_RESET, PIN_ANALOGIC, PIN_PUSH_PULL, PIN_NO_PULL, 0 );
+}
+
+static void SX126xIoResume( void *context )
+{
+    GpioInit( &SX126x.Reset, RADIO_RESET, PIN_OUTPUT, PIN_PUSH_PULL, PIN_NO_PULL, 1 );
 }
 
 void SX126xWaitOnBusy( void )
 {
-    while( GpioRead( &SX126x.BUSY ) == 1 );
+    while( GpioMcuFastRead( &SX126x.BUSY ) == 1 );
 }
 
+/*
+ * The accessors below do not wait for BUSY to drop after a transfer: the
+ * radio processes the command while the MCU prepares the next one, and
+ * SX126xCheckDeviceReady waits for BUSY before the next access.
+ */
+
 void SX126xWakeup( void )
 {
     CRITICAL_SECTION_BEGIN( );
 
-    GpioWrite( &SX126x.Spi.Nss, 0 );
+    WakeStartCycles = DWT->CYCCNT;
+    WakeToTxPending = true;
+
+    GpioMcuFastWrite( &SX126x.Spi.Nss, 0 );
 
     SpiInOut( &SX126x.Spi, RADIO_GET_STATUS );
     SpiInOut( &SX126x.Spi, 0x00 );
 
-    GpioWrite( &SX126x.Spi.Nss, 1 );
+    GpioMcuFastWrite( &SX126x.Spi.Nss, 1 );
 
     // Wait for chip to be ready.
     SX126xWaitOnBusy( );
 
+    PowerStats.Wakeups++;
+    PowerStats.WakeLatencyUs = SX126xCyclesToUs( DWT->CYCCNT - WakeStartCycles );
+    PowerStats.WakeLatencyMaxUs = MAX( PowerStats.WakeLatencyMaxUs, PowerStats.WakeLatencyUs );
+
     // Update operating mode context variable
     SX126xSetOperatingMode( MODE_STDBY_RC );
 
@@ -180,9 +655,18 @@ void SX126xWakeup( void )
 
 void SX126xWriteCommand( RadioCommands_t command, uint8_t *buffer, uint16_t size )
 {
+    if( ( SX126xPowerManagerFilter( command, buffer ) == false ) ||
+        ( SX126xCommandShadowUpdate( command, buffer, size ) == false ) )
+    {
+        CommandStats.Skipped++;
+        return;
+    }
+
+    CommandStats.Sent++;
+
     SX126xCheckDeviceReady( );
 
-    GpioWrite( &SX126x.Spi.Nss, 0 );
+    GpioMcuFastWrite( &SX126x.Spi.Nss, 0 );
 
     SpiInOut( &SX126x.Spi, ( uint8_t )command );
 
@@ -191,12 +675,7 @@ void SX126xWriteCommand( RadioCommands_t command, uint8_t *buffer, uint16_t size
         SpiInOut( &SX126x.Spi, buffer[i] );
     }
 
-    GpioWrite( &SX126x.Spi.Nss, 1 );
-
-    if( command != RADIO_SET_SLEEP )
-    {
-        SX126xWaitOnBusy( );
-    }
+    GpioMcuFastWrite( &SX126x.Spi.Nss, 1 );
 }
 
 uint8_t SX126xReadCommand( RadioCommands_t command, uint8_t *buffer, uint16_t size )
@@ -205,7 +684,7 @@ uint8_t SX126xReadCommand( RadioCommands_t command, uint8_t *buffer, uint16_t si
 
     SX126xCheckDeviceReady( );
 
-    GpioWrite( &SX126x.Spi.Nss, 0 );
+    GpioMcuFastWrite( &SX126x.Spi.Nss, 0 );
 
     SpiInOut( &SX126x.Spi, ( uint8_t )command );
     status = SpiInOut( &SX126x.Spi, 0x00 );
@@ -214,18 +693,23 @@ uint8_t SX126xReadCommand( RadioCommands_t command, uint8_t *buffer, uint16_t si
         buffer[i] = SpiInOut( &SX126x.Spi, 0 );
     }
 
-    GpioWrite( &SX126x.Spi.Nss, 1 );
-
-    SX126xWaitOnBusy( );
+    GpioMcuFastWrite( &SX126x.Spi.Nss, 1 );
 
     return status;
 }
 
 void SX126xWriteRegisters( uint16_t address, uint8_t *buffer, uint16_t size )
 {
+    // The driver picks the RX gain per call (Rx or RxBoosted), apply the profile instead
+    if( ( address <= REG_RX_GAIN ) && ( REG_RX_GAIN < ( address + size ) ) )
+    {
+        buffer[REG_RX_GAIN - address] = ( RxGain == SX126X_RX_GAIN_BOOSTED ) ?
+                                        SX126X_RX_GAIN_BOOSTED_VALUE : SX126X_RX_GAIN_POWER_SAVING_VALUE;
+    }
+
     SX126xCheckDeviceReady( );
 
-    GpioWrite( &SX126x.Spi.Nss, 0 );
+    GpioMcuFastWrite( &SX126x.Spi.Nss, 0 );
     
     SpiInOut( &SX126x.Spi, RADIO_WRITE_REGISTER );
     SpiInOut( &SX126x.Spi, ( address & 0xFF00 ) >> 8 );
@@ -236,9 +720,19 @@ void SX126xWriteRegisters( uint16_t address, uint8_t *buffer, uint16_t size )
         SpiInOut( &SX126x.Spi, buffer[i] );
     }
 
-    GpioWrite( &SX126x.Spi.Nss, 1 );
+    GpioMcuFastWrite( &SX126x.Spi.Nss, 1 );
 
-    SX126xWaitOnBusy( );
+    // Write-through
+    for( uint16_t i = 0; i < size; i++ )
+    {
+        SX126xRegisterShadow_t *shadow = SX126xRegisterShadowFind( address + i );
+
+        if( shadow != NULL )
+        {
+            shadow->Value = buffer[i];
+            shadow->Valid = true;
+        }
+    }
 }
 
 void SX126xWriteRegister( uint16_t address, uint8_t value )
@@ -248,21 +742,65 @@ void SX126xWriteRegister( uint16_t address, uint8_t value )
 
 void SX126xReadRegisters( uint16_t address, uint8_t *buffer, uint16_t size )
 {
+    SX126xRegisterShadow_t *shadow;
+    bool cacheable = true;
+    uint16_t i;
+
+    for( i = 0; i < size; i++ )
+    {
+        shadow = SX126xRegisterShadowFind( address + i );
+
+        if( shadow == NULL )
+        {
+            cacheable = false;
+            break;
+        }
+        if( shadow->Valid == false )
+        {
+            break;
+        }
+        buffer[i] = shadow->Value;
+    }
+
+    if( i == size )
+    {
+        RegisterCacheStats.Hits++;
+        return;
+    }
+
+    if( cacheable == true )
+    {
+        RegisterCacheStats.Misses++;
+    }
+    else
+    {
+        RegisterCacheStats.Uncached++;
+    }
+
     SX126xCheckDeviceReady( );
 
-    GpioWrite( &SX126x.Spi.Nss, 0 );
+    GpioMcuFastWrite( &SX126x.Spi.Nss, 0 );
 
     SpiInOut( &SX126x.Spi, RADIO_READ_REGISTER );
     SpiInOut( &SX126x.Spi, ( address & 0xFF00 ) >> 8 );
     SpiInOut( &SX126x.Spi, address & 0x00FF );
     SpiInOut( &SX126x.Spi, 0 );
-    for( uint16_t i = 0; i < size; i++ )
+    for( i = 0; i < size; i++ )
     {
         buffer[i] = SpiInOut( &SX126x.Spi, 0 );
     }
-    GpioWrite( &SX126x.Spi.Nss, 1 );
+    GpioMcuFastWrite( &SX126x.Spi.Nss, 1 );
 
-    SX126xWaitOnBusy( );
+    for( i = 0; i < size; i++ )
+    {
+        shadow = SX126xRegisterShadowFind( address + i );
+
+        if( shadow != NULL )
+        {
+            shadow->Value = buffer[i];
+            shadow->Valid = true;
+        }
+    }
 }
 
 uint8_t SX126xReadRegister( uint16_t address )
@@ -276,7 +814,7 @@ void SX126xWriteBuffer( uint8_t offset, uint8_t *buffer, uint8_t size )
 {
     SX126xCheckDeviceReady( );
 
-    GpioWrite( &SX126x.Spi.Nss, 0 );
+    GpioMcuFastWrite( &SX126x.Spi.Nss, 0 );
 
     SpiInOut( &SX126x.Spi, RADIO_WRITE_BUFFER );
     SpiInOut( &SX126x.Spi, offset );
@@ -284,16 +822,14 @@ void SX126xWriteBuffer( uint8_t offset, uint8_t *buffer, uint8_t size )
     {
         SpiInOut( &SX126x.Spi, buffer[i] );
     }
-    GpioWrite( &SX126x.Spi.Nss, 1 );
-
-    SX126xWaitOnBusy( );
+    GpioMcuFastWrite( &SX126x.Spi.Nss, 1 );
 }
 
 void SX126xReadBuffer( uint8_t offset, uint8_t *buffer, uint8_t size )
 {
     SX126xCheckDeviceReady( );
 
-    GpioWrite( &SX126x.Spi.Nss, 0 );
+    GpioMcuFastWrite( &SX126x.Spi.Nss, 0 );
 
     SpiInOut( &SX126x.Spi, RADIO_READ_BUFFER );
     SpiInOut( &SX126x.Spi, offset );
@@ -302,16 +838,56 @@ void SX126xReadBuffer( uint8_t offset, uint8_t *buffer, uint8_t size )
     {
         buffer[i] = SpiInOut( &SX126x.Spi, 0 );
     }
-    GpioWrite( &SX126x.Spi.Nss, 1 );
-
-    SX126xWaitOnBusy( );
+    GpioMcuFastWrite( &SX126x.Spi.Nss, 1 );
 }
 
 void SX126xSetRfTxPower( int8_t power )
 {
+    uint8_t i;
+
+    // Smallest PA profile reaching the requested power
+    for( i = 0; i < ( sizeof( PaProfiles ) / sizeof( PaProfiles[0] ) - 1 ); i++ )
+    {
+        if( PaProfiles[i].Power >= power )
+        {
+            break;
+        }
+    }
+
+    PaProfile = &PaProfiles[i];
+    PaPowerParam = SX126X_PA_POWER_PARAM_MAX - ( PaProfile->Power - MIN( power, PaProfile->Power ) );
+    PaPowerParam = MAX( PaPowerParam, SX126X_PA_POWER_PARAM_MIN );
+    TxPower = MIN( power, PaProfile->Power );
+
     SX126xSetTxParams( power, RADIO_RAMP_40_US );
 }
 
+void SX126xSetRxGainProfile( SX126xRxGain_t gain )
+{
+    RxGain = gain;
+}
+
+void SX126xGetPowerProfile( SX126xPowerProfile_t *profile )
+{
+    bool dcdc = ( BOARD_RADIO_REGULATOR_MODE == USE_DCDC );
+
+    profile->TxPower = TxPower;
+    profile->PaDutyCycle = ( PaProfile != NULL ) ? PaProfile->PaDutyCycle : 0;
+    profile->HpMax = ( PaProfile != NULL ) ? PaProfile->HpMax : 0;
+    profile->TxCurrentMa = ( PaProfile != NULL ) ? PaProfile->TxCurrentMa : 0;
+    profile->RxGain = RxGain;
+
+    // Typical LoRa 125 kHz RX currents, DS_SX1261-2 table 3-5
+    if( RxGain == SX126X_RX_GAIN_BOOSTED )
+    {
+        profile->RxCurrentUa = dcdc ? 5300 : 10100;
+    }
+    else
+    {
+        profile->RxCurrentUa = dcdc ? 4600 : 8800;
+    }
+}
+
 uint8_t SX126xGetDeviceId( void )
 {
     
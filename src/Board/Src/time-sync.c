@@ -0,0 +1,234 @@
+/**
+ ******************************************************************************
+ * @file      time-sync.c
+ * @author    Dean Prince Agbodjan
+ * @brief     Network time disciplined against the RTC drift
+ *
+ * @note      Each DeviceTimeAns or clock sync answer sets the LoRaMac system
+ *            time. The module anchors on it and, from the RTC time elapsed
+ *            between two syncs, measures how fast the RTC runs. The LSI
+ *            clocking the RTC can be a few percent off, far beyond the
+ *            smooth calibration range, so the rate is corrected when the
+ *            time is read instead. The anchor and the rate are kept in the
+ *            backup registers along with the calendar.
+ *
+ ******************************************************************************
+ */
+
+/* Includes */
+#include <stdio.h>
+
+#include "time-sync.h"
+#include "rtc-mcu.h"
+
+/* Backup registers, after the ones of the RTC driver */
+#define TIME_SYNC_BKP_FLAGS         (RTC_BKUP_FIRST_FREE + 0)
+#define TIME_SYNC_BKP_DRIFT         (RTC_BKUP_FIRST_FREE + 1)
+#define TIME_SYNC_BKP_MCU_S         (RTC_BKUP_FIRST_FREE + 2)
+#define TIME_SYNC_BKP_TIME_S        (RTC_BKUP_FIRST_FREE + 3)
+#define TIME_SYNC_BKP_MS            (RTC_BKUP_FIRST_FREE + 4)    /* RTC ms << 16 | network ms */
+
+#define TIME_SYNC_MAGIC             0x75C00000
+#define TIME_SYNC_MAGIC_MASK        0xFFFF0000
+#define TIME_SYNC_DRIFT_KNOWN       0x00000001
+
+#define PPB                         1000000000LL
+
+/* Shorter baselines measure the transmission jitter more than the drift */
+#define TIME_SYNC_MIN_BASELINE_MS   (50 * 60 * 1000LL)
+
+/* Resync when the drift may have moved the time by this much */
+#define TIME_SYNC_TARGET_ERROR_MS   1000LL
+#define TIME_SYNC_DRIFT_CHANGE_PPB  50000       /* assumed until two drifts are measured */
+#define TIME_SYNC_MIN_RESYNC_MS     (60 * 60 * 1000LL)
+#define TIME_SYNC_MAX_RESYNC_MS     (24 * 60 * 60 * 1000LL)
+
+/**
+ * Time at the same instant on the RTC calendar and on the network, in ms
+ */
+typedef struct{
+    int64_t Mcu;
+    int64_t Time;                   /* Unix epoch, as the LoRaMac system time */
+} TimeSyncPoint_t;
+
+static TimeSyncPoint_t Anchor;      /* last sync, the time is carried from it */
+static TimeSyncPoint_t Reference;   /* start of the baseline of the next drift */
+static bool Anchored = false;
+static bool ReferenceSet = false;
+static int32_t DriftChangePpb = TIME_SYNC_DRIFT_CHANGE_PPB;
+static TimeSync_Stats_t Stats;
+
+/**
+ * @brief Converts a system time to milliseconds
+ *
+ * @param [IN] time system time
+ *
+ * @return int64_t, milliseconds since the epoch of the time
+ */
+static int64_t ToMs( SysTime_t time )
+{
+    return (int64_t)time.Seconds * 1000 + time.SubSeconds;
+}
+
+/**
+ * @brief Gets the network time at an RTC time, from the anchor and the drift
+ *
+ * @param [IN] mcu RTC calendar time [ms]
+ *
+ * @return int64_t, Unix time [ms]
+ */
+static int64_t Predict( int64_t mcu )
+{
+    int64_t elapsed = mcu - Anchor.Mcu;
+
+    return Anchor.Time + elapsed - (elapsed * Stats.DriftPpb) / (PPB + Stats.DriftPpb);
+}
+
+/**
+ * @brief Keeps the anchor and the drift across the resets
+ */
+static void Save( void )
+{
+    RtcBkupWriteIndex(TIME_SYNC_BKP_DRIFT, (uint32_t)Stats.DriftPpb);
+    RtcBkupWriteIndex(TIME_SYNC_BKP_MCU_S, (uint32_t)(Anchor.Mcu / 1000));
+    RtcBkupWriteIndex(TIME_SYNC_BKP_TIME_S, (uint32_t)(Anchor.Time / 1000));
+    RtcBkupWriteIndex(TIME_SYNC_BKP_MS, ((uint32_t)(Anchor.Mcu % 1000) << 16) | (uint32_t)(Anchor.Time % 1000));
+    RtcBkupWriteIndex(TIME_SYNC_BKP_FLAGS, TIME_SYNC_MAGIC | (Stats.DriftKnown ? TIME_SYNC_DRIFT_KNOWN : 0));
+}
+
+/**
+ * @brief Restores the last sync, when the calendar kept counting since
+ *
+ * @note Call after RtcInit.
+ */
+void TimeSync_Init( void )
+{
+    uint32_t flags = RtcBkupReadIndex(TIME_SYNC_BKP_FLAGS);
+    uint32_t ms = RtcBkupReadIndex(TIME_SYNC_BKP_MS);
+
+    if ((RtcIsCalendarKept() == false) || ((flags & TIME_SYNC_MAGIC_MASK) != TIME_SYNC_MAGIC))
+    {
+        return;
+    }
+
+    Anchor.Mcu = (int64_t)RtcBkupReadIndex(TIME_SYNC_BKP_MCU_S) * 1000 + (ms >> 16);
+    Anchor.Time = (int64_t)RtcBkupReadIndex(TIME_SYNC_BKP_TIME_S) * 1000 + (ms & 0xFFFF);
+    Stats.DriftPpb = (int32_t)RtcBkupReadIndex(TIME_SYNC_BKP_DRIFT);
+    Stats.DriftKnown = (flags & TIME_SYNC_DRIFT_KNOWN) != 0;
+    Stats.LastSyncGps = (uint32_t)(Anchor.Time / 1000 - UNIX_GPS_EPOCH_OFFSET);
+    Reference = Anchor;
+    Anchored = true;
+    ReferenceSet = true;
+
+    printf("Time restored from GPS %lu, drift %ld ppb\n",
+           (unsigned long)Stats.LastSyncGps, (long)Stats.DriftPpb);
+}
+
+/**
+ * @brief Takes the system time just set by the network as the new anchor
+ *
+ * @note Call on LORAWAN_EVENT_TIME_SYNCED. The drift is measured once the
+ *       baseline since the previous measurement is long enough.
+ */
+void TimeSync_OnUpdate( void )
+{
+    TimeSyncPoint_t now = {
+        .Mcu = ToMs(SysTimeGetMcuTime()),
+        .Time = ToMs(SysTimeGet()),
+    };
+
+    if (Anchored == true)
+    {
+        int64_t error = Predict(now.Mcu) - now.Time;
+
+        Stats.LastErrorMs = (error > INT32_MAX) ? INT32_MAX : (error < INT32_MIN) ? INT32_MIN : (int32_t)error;
+    }
+
+    if (ReferenceSet == false)
+    {
+        Reference = now;
+        ReferenceSet = true;
+    }
+    else if ((now.Time - Reference.Time) >= TIME_SYNC_MIN_BASELINE_MS)
+    {
+        int64_t baseline = now.Time - Reference.Time;
+        int32_t drift = (int32_t)((((now.Mcu - Reference.Mcu) - baseline) * PPB) / baseline);
+
+        if (Stats.DriftKnown == true)
+        {
+            DriftChangePpb = (drift > Stats.DriftPpb) ? drift - Stats.DriftPpb : Stats.DriftPpb - drift;
+        }
+        Stats.DriftPpb = drift;
+        Stats.DriftKnown = true;
+        Reference = now;
+    }
+
+    Anchor = now;
+    Anchored = true;
+    Stats.Syncs++;
+    Stats.LastSyncGps = (uint32_t)(now.Time / 1000 - UNIX_GPS_EPOCH_OFFSET);
+    Save();
+
+    printf("Time synced to GPS %lu, error %ld ms, drift %ld ppb\n", (unsigned long)Stats.LastSyncGps,
+           (long)Stats.LastErrorMs, (long)Stats.DriftPpb);
+}
+
+/**
+ * @brief Gets the GPS time, the RTC time elapsed since the last sync being
+ *        corrected by the drift
+ *
+ * @param [OUT] time GPS seconds and milliseconds
+ *
+ * @return bool, false before the first sync
+ */
+bool TimeSync_GetGpsTime( SysTime_t *time )
+{
+    if (Anchored == false)
+    {
+        return false;
+    }
+
+    int64_t gps = Predict(ToMs(SysTimeGetMcuTime())) - UNIX_GPS_EPOCH_OFFSET * 1000LL;
+
+    time->Seconds = (uint32_t)(gps / 1000);
+    time->SubSeconds = (int16_t)(gps % 1000);
+    return true;
+}
+
+/**
+ * @brief Gets the time until the next sync is worth requesting
+ *
+ * @note The drift is assumed to move as much as between the last two
+ *       measurements, the sync comes before it makes TIME_SYNC_TARGET_ERROR_MS.
+ *
+ * @return uint32_t, delay [ms]
+ */
+uint32_t TimeSync_GetResyncMs( void )
+{
+    if (Stats.DriftKnown == false)
+    {
+        return TIME_SYNC_MIN_RESYNC_MS;
+    }
+
+    int64_t delay = (TIME_SYNC_TARGET_ERROR_MS * PPB) / ((DriftChangePpb > 0) ? DriftChangePpb : 1);
+
+    if (delay < TIME_SYNC_MIN_RESYNC_MS)
+    {
+        return TIME_SYNC_MIN_RESYNC_MS;
+    }
+    if (delay > TIME_SYNC_MAX_RESYNC_MS)
+    {
+        return TIME_SYNC_MAX_RESYNC_MS;
+    }
+    return (uint32_t)delay;
+}
+
+/**
+ * @brief Gets the sync statistics
+ *
+ * @param [OUT] stats pointer to the statistics
+ */
+void TimeSync_GetStats( TimeSync_Stats_t *stats )
+{
+    *stats = Stats;
+}
@@ -1,8 +1,13 @@
-// LoRaWAN region to use, full list of regions can be found at: 
+
+// LoRaWAN region to use, full list of regions can be found at:
 //   http://stackforce.github.io/LoRaMac-doc/LoRaMac-doc-v4.5.1/group___l_o_r_a_m_a_c.html#ga3b9d54f0355b51e85df8b33fd1757eec
 #define LORAWAN_REGION          LORAMAC_REGION_US915
 
-// LoRaWAN Device EUI (64-bit), NULL value will use Default Dev EUI
+// The credentials below are converted to binary at compile time and placed in
+// the .lorawan_credentials flash section. Use tools/provision.py to stamp
+// per-device values into the .bin without rebuilding.
+
+// LoRaWAN Device EUI (64-bit), leave undefined to use the default Dev EUI
 #define LORAWAN_DEVICE_EUI      "70B3D57ED005CB05"
 
 // LoRaWAN Application / Join EUI (64-bit)
@@ -11,6 +16,23 @@
 // LoRaWAN Application Key (128-bit)
 #define LORAWAN_APP_KEY         "D9EE772A323797A6F16ABCE86B6473A9"
 
-// LoRaWAN Channel Mask, NULL value will use the default channel mask 
-// for the region
-#define LORAWAN_CHANNEL_MASK    NULL
\ No newline at end of file
+// LoRaWAN ABP Device Address (32-bit) and session keys (128-bit), only used
+// with lorawan_init_abp
+// #define LORAWAN_DEVICE_ADDRESS  "00000000"
+// #define LORAWAN_NWK_S_KEY       "00000000000000000000000000000000"
+// #define LORAWAN_APP_S_KEY       "00000000000000000000000000000000"
+
+// LoRaWAN Channel Mask (6 x 16-bit), leave undefined to use the default
+// channel mask for the region
+// #define LORAWAN_CHANNEL_MASK    "00FF00000000000000000000"
+
+// Alert thresholds, in 0.01 degC and 0.01 %RH. A reading crossing one is sent
+// right away on its own port, ahead of the window summaries. The alert clears
+// once the reading is back past the threshold by the hysteresis.
+#define ALERT_FROST_TEMPERATURE     200     // at or below 2.00 degC
+#define ALERT_FROST_HYSTERESIS      100
+#define ALERT_HIGH_HUMIDITY         9000    // at or above 90.00 %RH
+#define ALERT_HUMIDITY_HYSTERESIS   500
+
+// Set to 1 to have the network acknowledge each alert
+#define ALERT_CONFIRMED             0
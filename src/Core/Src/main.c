@@ -20,10 +20,15 @@
 #include "board.h"
 #include "board-config.h"
 #include "config.h"
+#include "credentials.h"
+#include "crypto-bench.h"
+#include "gpio-bench.h"
 #include "delay-board.h"
 #include "rtc-board.h"
 #include "lorawan.h"
 #include "lpm-board.h"
+#include "scheduler.h"
+#include "sensor.h"
 
 #include "stm32f4xx.h"
 #include "stm32f4xx_hal.h"
@@ -33,30 +38,203 @@
 
 #include "cJSON.h"
 #include "dht.h"
+#include "sht3x.h"
+#include "summary.h"
 #include "temt.h"
+#include "time-sync.h"
 #include "watchdog.h"
 
 /* Private Functions */
 static void app_main( void );
-static void EnterLowMode();
+static void HandleLoRaWANEvent(const struct lorawan_event *event);
+static void OnClimateSample(const Sensor_t *sensor, bool valid);
+static void OnLightSample(const Sensor_t *sensor, bool valid);
+static void ReportTask(void *context);
+static void UplinkTask(void *context);
+static void AlertTask(void *context);
+static void TimeSyncTask(void *context);
+static void WatchdogTask(void *context);
+static int SendFrame(const void *data, uint8_t size, uint8_t port, bool confirmed);
+static void DropRecords(const char *reason);
+static void CheckAlerts(const Sensor_t *sensor);
+static bool AlertsPending(void);
+static void RetryAlerts(uint16_t inFlight, const char *reason);
+static void GetClimateErrors(uint32_t *reads, uint32_t *failures);
+static void EncodeSummary(uint8_t *record, const Summary_t *summary);
+static void AddSummaryToObject(cJSON *object, const char *name, const Summary_t *summary, double unit);
+static bool GetTimeStamp(uint32_t *seconds);
+static void ReleaseReports(void);
+static void SettleUplink(bool resend, const char *reason);
+
+/* Uplink ports */
+#define JSON_PORT               2
+#define LPP_PORT                3   /* Cayenne LPP style records, used when the JSON frame does not fit */
+#define ALERT_PORT              5   /* threshold crossings, ahead of the other frames */
+
+/* Cayenne LPP record types */
+#define LPP_ANALOG_INPUT        0x02    /* 2 bytes, signed, 0.01 */
+#define LPP_ANALOG_INPUT_SIZE   4
+
+/*
+ * Window summary, not part of Cayenne LPP, the channel tells the quantity:
+ * min, max, mean (2 bytes each, signed) in the channel unit, then the
+ * variance (2 bytes, unsigned, saturated) in the square of the channel
+ * unit / 100. One byte under the 11 allowed at the slowest datarate.
+ */
+#define LPP_SUMMARY             0x80
+#define LPP_SUMMARY_SIZE        10
+
+/*
+ * Time of the records after it in the frame, on channel 0: GPS seconds
+ * modulo 65536 (2 bytes, unsigned). The server takes the latest such time
+ * before the arrival, exact for frames delayed up to 18 hours. Left out
+ * before the first time sync, the arrival time is the only one then.
+ */
+#define LPP_TIME                0x81
+#define LPP_TIME_SIZE           4
+
+/* Sampling periods, each sample goes into the summary of the window */
+#define CLIMATE_PERIOD_MS       60000   /* temperature and humidity change slowly */
+#define LIGHT_PERIOD_MS         10000
+
+/* Adaptive sampling bounds, the periods above are the starting points */
+#define CLIMATE_MIN_PERIOD_MS   15000
+#define CLIMATE_MAX_PERIOD_MS   300000
+#define LIGHT_MIN_PERIOD_MS     5000
+#define LIGHT_MAX_PERIOD_MS     120000
+
+/* One summary uplink per reporting window, whatever the sampling periods */
+#define REPORT_PERIOD_MS        300000
+#define REPORT_SLACK_MS         (REPORT_PERIOD_MS / 10)
+#define REPORT_QUEUE_SIZE       4       /* closed windows kept while the uplinks lag behind */
+#define UPLINK_RETRY_MS         10000   /* after a refused request, unless a TX done comes first */
+
+/* Temperature and humidity sensor, chosen at build time */
+#ifdef SENSOR_SHT3X
+#define CLIMATE_DRIVER          SHT3x_SensorDriver
+#define CLIMATE_PROBES          1
+#else
+#define CLIMATE_DRIVER          DHT_SensorDriver
+#define CLIMATE_PROBES          DHT_GetCount()
+#endif
+
+/*
+ * Alert record: rule, state (bit 0 raised, bit 1 time valid), reading (2 bytes,
+ * signed, 0.01), time of the crossing as in LPP_TIME
+ */
+#define ALERT_RECORD_SIZE       6
+#define ALERT_RAISED            0x01
+#define ALERT_TIMED             0x02
+#define ALERT_MAX_ATTEMPTS      3       /* transmissions of an alert before it is dropped */
+#define ALERT_RETRY_MS          10000   /* after a refused request, unless a TX done comes first */
+
+/* Task periods */
+/* Time sync requests, resync delay set by time-sync.c */
+#define TIME_SYNC_RETRY_MS      600000  /* no answer yet, asked again with a later uplink */
+#define TIME_SYNC_SLACK_MS      (TIME_SYNC_RETRY_MS / 10)
+
+/* An early run does not move the next deadline, refreshes are up to period + slack apart */
+#define WATCHDOG_PERIOD_MS      5000
+#define WATCHDOG_SLACK_MS       2000    /* 7 s worst case, well within the 10 s IWDG timeout */
 
 /* variables */
-static bool enterSleepMode = true;
-
-/* OTAA settings */
-const struct lorawan_otaa_settings otaa_settings = {
-    .device_eui   = LORAWAN_DEVICE_EUI,
-    .app_eui      = LORAWAN_APP_EUI,
-    .app_key      = LORAWAN_APP_KEY,
-    .channel_mask = LORAWAN_CHANNEL_MASK
+
+/* OTAA settings, filled from the credentials flash section */
+static struct lorawan_otaa_settings otaa_settings;
+
+/* Tasks */
+static SchedulerTask_t reportTask;
+static SchedulerTask_t uplinkTask;
+static SchedulerTask_t alertTask;
+static SchedulerTask_t timeSyncTask;
+static SchedulerTask_t watchdogTask;
+
+/* Sensors */
+static Sensor_t climateSensor;
+static Sensor_t lightSensor;
+
+/* Change worth a sample: 0.5 degC and 2 % for each probe, 50 ADC counts of light */
+static const int32_t climateSteps[SENSOR_MAX_CHANNELS] = { 50, 200, 50, 200, 50, 200, 50, 200 };
+static const int32_t lightSteps[SENSOR_MAX_CHANNELS] = { 50 };
+
+/* Window being sampled, temperature and humidity in 0.01 units */
+static Summary_t tempWindow[DHT_MAX_SENSORS], humWindow[DHT_MAX_SENSORS], sunlightWindow;
+
+/* Climate sensor reads failed since the previous valid one [0.01 %], sent while not 0 */
+static int climateErrorRate = 0;
+static uint32_t climateReportedReads, climateReportedFailures;
+
+/*
+ * The summaries of a window as LPP style records. The first DHT probe keeps
+ * channels 1 and 2, the other probes follow the sensor errors from channel 5.
+ */
+#define CLIMATE_RECORD(probe)   (2 + 2 * (probe))   /* temperature, humidity next */
+#define SUNLIGHT_RECORD         0
+#define CLIMATE_ERROR_RECORD    1
+#define RECORD_COUNT            CLIMATE_RECORD(DHT_MAX_SENSORS)
+
+static const uint8_t recordChannels[RECORD_COUNT] = { 3, 4, 1, 2, 5, 6, 7, 8, 9, 10 };
+static const uint8_t recordPriorities[RECORD_COUNT] = { 2, 3, 0, 1, 4, 5, 6, 7, 8, 9 };
+
+/**
+ * Closed reporting window, kept until its summaries are sent
+ */
+typedef struct{
+    uint32_t Time;                  /* end of the window [GPS s], when Timed */
+    bool Timed;
+    bool JsonPending;
+    bool JsonInFlight;
+    uint16_t InFlight;              /* records in the uplink in flight */
+    int ClimateErrorRate;
+    Summary_t Temp[DHT_MAX_SENSORS];
+    Summary_t Hum[DHT_MAX_SENSORS];
+    Summary_t Sunlight;
+    uint8_t Data[RECORD_COUNT][LPP_SUMMARY_SIZE];
+    struct lorawan_record Records[RECORD_COUNT];
+} ReportWindow_t;
+
+/* Oldest first, a window closing on a full queue pushes the oldest out */
+static ReportWindow_t reportQueue[REPORT_QUEUE_SIZE];
+static uint8_t reportHead = 0;
+static uint8_t reportCount = 0;
+static uint32_t reportsDropped = 0;
+
+static ReportWindow_t *OpenReport(void);
+static ReportWindow_t *GetReport(uint8_t index);
+static uint16_t PendingRecords(const ReportWindow_t *report);
+static bool ReportsPending(void);
+
+/* Handle of the uplink in flight, 0 when none */
+static int uplinkHandle = 0;
+
+/**
+ * Threshold on a channel of the climate sensor
+ */
+typedef struct{
+    const char *Name;
+    uint8_t Channel;                /* index in the sensor values */
+    int32_t Threshold;
+    int32_t Hysteresis;
+    bool Above;                     /* raised above the threshold, else below */
+    bool Active;
+    uint8_t Attempts;
+    uint8_t Record[ALERT_RECORD_SIZE];
+} AlertRule_t;
+
+/* On the first probe, see config.h */
+static AlertRule_t alertRules[] = {
+    { .Name = "frost", .Channel = 0, .Threshold = ALERT_FROST_TEMPERATURE,
+      .Hysteresis = ALERT_FROST_HYSTERESIS, .Above = false },
+    { .Name = "humidity", .Channel = 1, .Threshold = ALERT_HIGH_HUMIDITY,
+      .Hysteresis = ALERT_HUMIDITY_HYSTERESIS, .Above = true },
 };
+#define ALERT_COUNT             (sizeof(alertRules) / sizeof(alertRules[0]))
 
-/* variables for receiving data */
-int receive_length = 0;
-uint8_t receive_buffer[242];
-uint8_t receive_port = 0;
+static struct lorawan_record alertRecords[ALERT_COUNT];
 
-extern RTC_HandleTypeDef RTC_HandleStruct;
+/* Handle of the alert frame in flight, 0 when none, and the alerts it carries */
+static int alertHandle = 0;
+static uint16_t alertsInFlight = 0;
 
 /* Main Function */
 int main(void)
@@ -69,148 +247,926 @@ int main(void)
 /**
  * @brief Application Logic
  *
- * @note Initializes the sensors, registers/connects to The Things Network via OTAA,
- *       reads and uploads data in CJSON format, and then goes to sleep mode.
- *       Wakes up from sleep and send data and go to sleep mode.
- *       Implemented a watchdog to improve reliability
+ * @note Registers/connects to The Things Network via OTAA, then samples each
+ *       sensor on its own period into the summary of the reporting window
+ *       and runs the report, uplink and watchdog tasks.
+ *       Between the task deadlines and the LoRaMac timers, the MCU sleeps and
+ *       wakes up once for whichever comes first.
  */
 
 
 static void app_main( void )
 {
-    int tempValue = 0, humValue , sunlightLevel = 0;
-    int receive_length = 0;
+    struct lorawan_event event;
 
-    /* Initializing DHT 11 sensor */
-    if (DHT_Init() == false)
-    {
-        printf("Failed to initialize DHT 11\n");
-        return;
-    }
+#ifdef CRYPTO_BENCHMARK
+    CryptoBench_Run();
+#endif
 
-    /* Initializing light sensor attached to an adc pin */
-    Temt_Init();
-    Temt_Config();
+#ifdef GPIO_BENCHMARK
+    GpioBench_Run();
+#endif
 
     printf("Initializing LoRaWAN....\n");
 
+    if (Credentials_IsValid() == false)
+    {
+        return;
+    }
+    Credentials_GetOtaaSettings(&otaa_settings);
+
     if (lorawan_init_otaa(LORAWAN_REGION, &otaa_settings) < 0) {
         printf("failed!!!\n");
         return ;
     } else {
         printf("success!!!!\n");
     }
-    
-    /* Start the join process and wait to join the things network */
+    TimeSync_Init();
+
+    Scheduler_Init();
+    Scheduler_AddTask(&watchdogTask, WatchdogTask, NULL, "watchdog", WATCHDOG_SLACK_MS);
+    Scheduler_AddTask(&reportTask, ReportTask, NULL, "report", REPORT_SLACK_MS);
+    Scheduler_AddTask(&uplinkTask, UplinkTask, NULL, "uplink", 0);
+    Scheduler_AddTask(&alertTask, AlertTask, NULL, "alert", 0);
+    Scheduler_AddTask(&timeSyncTask, TimeSyncTask, NULL, "time sync", TIME_SYNC_SLACK_MS);
+
+    for (size_t i = 0; i < ALERT_COUNT; i++)
+    {
+        alertRecords[i] = (struct lorawan_record){
+            .data = alertRules[i].Record, .size = ALERT_RECORD_SIZE, .priority = i, .packed = true,
+        };
+    }
+    Scheduler_Start(&watchdogTask, WATCHDOG_PERIOD_MS, WATCHDOG_PERIOD_MS);
+
+    /* DHT 11 or SHT3x and the light sensor attached to an adc pin */
+    if ((Sensor_Register(&climateSensor, &CLIMATE_DRIVER, CLIMATE_PERIOD_MS, 0, OnClimateSample) == false) ||
+        (Sensor_Register(&lightSensor, &Temt_SensorDriver, LIGHT_PERIOD_MS, 0, OnLightSample) == false))
+    {
+        return;
+    }
+    Sensor_SetAdaptive(&climateSensor, CLIMATE_MIN_PERIOD_MS, CLIMATE_MAX_PERIOD_MS, climateSteps);
+    Sensor_SetAdaptive(&lightSensor, LIGHT_MIN_PERIOD_MS, LIGHT_MAX_PERIOD_MS, lightSteps);
+
+    /* Start the join process, the sampling starts once joined */
     printf("Joining the LoRaWAN network\n");
     lorawan_join();
 
     printf("Waiting to Join\n");
 
-    while (!lorawan_is_joined())  
+    while (1)
     {
-        //lorawan_process();
-        lorawan_process_timeout_ms(1000);
+        lorawan_process();
+
+        while (lorawan_event_get(&event))
+        {
+            HandleLoRaWANEvent(&event);
+        }
+
+        Scheduler_Process();
+
+        /* Sleep until the next task deadline, LoRaMac timer or radio interrupt */
+        Scheduler_Sleep(lorawan_is_idle);
     }
+}
 
-    while (1)
+/**
+  * @brief Adds the new temperature and humidity readings to the window
+  *
+  * @note A probe that failed is left out of the window for that sample.
+  *
+  * @param [IN] sensor DHT 11 probes or SHT3x
+  * @param [IN] valid false when every probe failed
+  */
+static void OnClimateSample(const Sensor_t *sensor, bool valid)
+{
+    if (valid == false)
+    {
+        printf("Failed to process data from %s\n", sensor->Driver->Name);
+        return;
+    }
+
+    for (uint8_t i = 0; i < CLIMATE_PROBES; i++)
     {
-        if (enterSleepMode == true)
+        if (sensor->Values[2 * i] == SENSOR_VALUE_INVALID)
         {
-            enterSleepMode = false;
+            continue;
+        }
 
-            /* Read humidity and temperature */
-            if (DHT_ProcessValues() == false)
-            {
-                printf("Failed to process data from DHT 11\n");
-                humValue = 0;
-                tempValue = 0;
-            } else {
-                humValue = DHT_GetHumValue();
-                tempValue = DHT_GetTempValue();
-            }
+        Summary_Add(&tempWindow[i], sensor->Values[2 * i]);
+        Summary_Add(&humWindow[i], sensor->Values[2 * i + 1]);
+    }
+
+    CheckAlerts(sensor);
+}
+
+/**
+  * @brief Raises or clears the alerts crossed by the new climate readings
+  *
+  * @param [IN] sensor climate sensor
+  */
+static void CheckAlerts(const Sensor_t *sensor)
+{
+    for (size_t i = 0; i < ALERT_COUNT; i++)
+    {
+        AlertRule_t *rule = &alertRules[i];
+        int32_t value = sensor->Values[rule->Channel];
+
+        if (value == SENSOR_VALUE_INVALID)
+        {
+            continue;
+        }
+
+        bool crossed = rule->Above ? (value >= rule->Threshold) : (value <= rule->Threshold);
+        bool back = rule->Above ? (value < rule->Threshold - rule->Hysteresis) :
+                                  (value > rule->Threshold + rule->Hysteresis);
+
+        if ((rule->Active && !back) || (!rule->Active && !crossed))
+        {
+            continue;
+        }
+
+        rule->Active = !rule->Active;
+        printf("Alert %s %s at %ld\n", rule->Name, rule->Active ? "raised" : "cleared", (long)value);
+
+        /* A newer state replaces the one not sent yet */
+        uint32_t time = 0;
+        bool timed = GetTimeStamp(&time);
+
+        rule->Record[0] = i;
+        rule->Record[1] = (rule->Active ? ALERT_RAISED : 0) | (timed ? ALERT_TIMED : 0);
+        rule->Record[2] = (uint8_t)((int16_t)value >> 8);
+        rule->Record[3] = (uint8_t)value;
+        rule->Record[4] = (uint8_t)(time >> 8);
+        rule->Record[5] = (uint8_t)time;
+        rule->Attempts = 0;
+        alertRecords[i].packed = false;
+
+        Scheduler_Start(&alertTask, 0, 0);
+    }
+}
+
+/**
+  * @brief Gets the climate sensor read counters, whatever the driver
+  *
+  * @param [OUT] reads reads since boot
+  * @param [OUT] failures failed reads since boot, all causes
+  */
+static void GetClimateErrors(uint32_t *reads, uint32_t *failures)
+{
+#ifdef SENSOR_SHT3X
+    SHT3x_Stats_t stats;
+    SHT3x_GetStats(&stats);
+    *reads = stats.Reads;
+    *failures = stats.Nack + stats.Bus + stats.Crc;
+#else
+    DHT_Stats_t stats;
+    DHT_GetStats(&stats);
+    *reads = stats.Reads;
+    *failures = stats.NoResponse + stats.ResponseTiming + stats.BitTiming + stats.Checksum;
+#endif
+}
+
+/**
+  * @brief Adds a new sunlight reading to the window
+  *
+  * @param [IN] sensor light sensor
+  * @param [IN] valid false when the reading failed
+  */
+static void OnLightSample(const Sensor_t *sensor, bool valid)
+{
+    if (valid == false)
+    {
+        return;
+    }
+
+    Summary_Add(&sunlightWindow, sensor->Values[0]);
+}
+
+/**
+  * @brief Closes the reporting window and hands its summaries to the uplink task
+  *
+  * @note The window is queued behind the ones not sent yet, with the time it
+  *       ends. A quantity with no sample in the window is not sent.
+  *
+  * @param [IN] context unused
+  */
+static void ReportTask(void *context)
+{
+    ReportWindow_t *report = OpenReport();
+
+    report->Timed = GetTimeStamp(&report->Time);
+
+    for (uint8_t i = 0; i < CLIMATE_PROBES; i++)
+    {
+        report->Temp[i] = tempWindow[i];
+        report->Hum[i] = humWindow[i];
+        Summary_Reset(&tempWindow[i]);
+        Summary_Reset(&humWindow[i]);
+
+        if (report->Temp[i].Count > 0)
+        {
+            EncodeSummary(report->Data[CLIMATE_RECORD(i)], &report->Temp[i]);
+            EncodeSummary(report->Data[CLIMATE_RECORD(i) + 1], &report->Hum[i]);
+            report->Records[CLIMATE_RECORD(i)].packed = false;
+            report->Records[CLIMATE_RECORD(i) + 1].packed = false;
+        }
+    }
+
+    report->Sunlight = sunlightWindow;
+    Summary_Reset(&sunlightWindow);
+    if (report->Sunlight.Count > 0)
+    {
+        EncodeSummary(report->Data[SUNLIGHT_RECORD], &report->Sunlight);
+        report->Records[SUNLIGHT_RECORD].packed = false;
+    }
+
+    /* Sensor bus quality, over the reads of every probe in the window */
+    uint32_t reads, failures;
+    GetClimateErrors(&reads, &failures);
+    reads -= climateReportedReads;
+    failures -= climateReportedFailures;
+    climateReportedReads += reads;
+    climateReportedFailures += failures;
+
+    if ((reads > 0) && ((failures > 0) || (climateErrorRate != 0)))
+    {
+        climateErrorRate = (int)((failures * 10000) / reads);
+        report->ClimateErrorRate = climateErrorRate;
+        report->Data[CLIMATE_ERROR_RECORD][2] = (uint8_t)(climateErrorRate >> 8);
+        report->Data[CLIMATE_ERROR_RECORD][3] = (uint8_t)climateErrorRate;
+        report->Records[CLIMATE_ERROR_RECORD].packed = false;
+    }
+
+    report->JsonPending = true;
+    Scheduler_Start(&uplinkTask, 0, 0);
+}
+
+/**
+  * @brief Queues a new window, empty, after the sent ones are released
+  *
+  * @note When the uplinks fell behind by REPORT_QUEUE_SIZE windows, the
+  *       oldest one is dropped, even from the frame in flight.
+  *
+  * @return ReportWindow_t*, the new window, every record packed
+  */
+static ReportWindow_t *OpenReport(void)
+{
+    ReleaseReports();
+
+    if (reportCount == REPORT_QUEUE_SIZE)
+    {
+        reportsDropped++;
+        printf("Oldest window dropped, queue full, %lu dropped so far\n", (unsigned long)reportsDropped);
+        reportHead = (reportHead + 1) % REPORT_QUEUE_SIZE;
+        reportCount--;
+    }
+
+    ReportWindow_t *report = &reportQueue[(reportHead + reportCount) % REPORT_QUEUE_SIZE];
+    reportCount++;
+
+    *report = (ReportWindow_t){ 0 };
+    for (size_t i = 0; i < RECORD_COUNT; i++)
+    {
+        report->Data[i][0] = recordChannels[i];
+        report->Data[i][1] = LPP_SUMMARY;
+        report->Records[i] = (struct lorawan_record){
+            .data = report->Data[i], .size = LPP_SUMMARY_SIZE, .priority = recordPriorities[i], .packed = true,
+        };
+    }
+    report->Data[CLIMATE_ERROR_RECORD][1] = LPP_ANALOG_INPUT;
+    report->Records[CLIMATE_ERROR_RECORD].size = LPP_ANALOG_INPUT_SIZE;
+
+    return report;
+}
+
+/**
+  * @brief Gets a queued window
+  *
+  * @param [IN] index 0 for the oldest, up to reportCount - 1
+  *
+  * @return ReportWindow_t*, the window
+  */
+static ReportWindow_t *GetReport(uint8_t index)
+{
+    return &reportQueue[(reportHead + index) % REPORT_QUEUE_SIZE];
+}
+
+/**
+  * @brief Gets the records of a window not sent yet
+  *
+  * @param [IN] report pointer to the window
+  *
+  * @return uint16_t, mask of the records
+  */
+static uint16_t PendingRecords(const ReportWindow_t *report)
+{
+    uint16_t pending = 0;
+
+    for (size_t i = 0; i < RECORD_COUNT; i++)
+    {
+        if (report->Records[i].packed == false)
+        {
+            pending |= 1 << i;
+        }
+    }
+    return pending;
+}
+
+/**
+  * @brief Tells whether a window waits for a frame
+  *
+  * @return bool, true when a JSON frame or a record of a window is not sent yet
+  */
+static bool ReportsPending(void)
+{
+    for (uint8_t k = 0; k < reportCount; k++)
+    {
+        if (GetReport(k)->JsonPending || (PendingRecords(GetReport(k)) != 0))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+  * @brief Frees the oldest windows, once nothing of them is left to send
+  */
+static void ReleaseReports(void)
+{
+    while (reportCount > 0)
+    {
+        ReportWindow_t *report = GetReport(0);
+
+        if (report->JsonPending || report->JsonInFlight || (report->InFlight != 0) ||
+            (PendingRecords(report) != 0))
+        {
+            break;
+        }
+        reportHead = (reportHead + 1) % REPORT_QUEUE_SIZE;
+        reportCount--;
+    }
+}
+
+/**
+  * @brief Writes a window summary into its record, after the channel and type
+  *
+  * @param [OUT] record pointer to the LPP_SUMMARY record
+  * @param [IN] summary pointer to the window statistics
+  */
+static void EncodeSummary(uint8_t *record, const Summary_t *summary)
+{
+    int16_t min = (int16_t)summary->Min;
+    int16_t max = (int16_t)summary->Max;
+    int16_t mean = (int16_t)Summary_GetMean(summary);
+    uint32_t variance = Summary_GetVariance(summary) / 100;
+
+    if (variance > UINT16_MAX)
+    {
+        variance = UINT16_MAX;
+    }
+
+    record[2] = (uint8_t)(min >> 8);
+    record[3] = (uint8_t)min;
+    record[4] = (uint8_t)(max >> 8);
+    record[5] = (uint8_t)max;
+    record[6] = (uint8_t)(mean >> 8);
+    record[7] = (uint8_t)mean;
+    record[8] = (uint8_t)(variance >> 8);
+    record[9] = (uint8_t)variance;
+}
+
+/**
+  * @brief Adds a window summary to the JSON frame, unless the window is empty
+  *
+  * @param [IN] object JSON object of the frame
+  * @param [IN] name quantity
+  * @param [IN] summary pointer to the window statistics
+  * @param [IN] unit value of one count of the channel
+  */
+static void AddSummaryToObject(cJSON *object, const char *name, const Summary_t *summary, double unit)
+{
+    if (summary->Count == 0)
+    {
+        return;
+    }
+
+    cJSON *item = cJSON_AddObjectToObject(object, name);
+    if (item == NULL)
+    {
+        return;
+    }
+
+    cJSON_AddNumberToObject(item, "n", summary->Count);
+    cJSON_AddNumberToObject(item, "min", summary->Min * unit);
+    cJSON_AddNumberToObject(item, "max", summary->Max * unit);
+    cJSON_AddNumberToObject(item, "mean", Summary_GetMean(summary) * unit);
+    cJSON_AddNumberToObject(item, "var", Summary_GetVariance(summary) * unit * unit);
+}
+
+/**
+  * @brief Sends the next frame of the window summaries
+  *
+  * @note The oldest window waiting for it goes out as one JSON frame when it
+  *       fits. Otherwise the windows are re-encoded as LPP style records, each
+  *       behind its LPP_TIME record, oldest first and as many as fit. The
+  *       least important records of a window go in a later frame. When the
+  *       pending MAC commands leave no room for any record, an empty frame
+  *       sends them first. Each TX done starts the task again for the
+  *       following frame. A refused request keeps its records queued and is
+  *       tried again after UPLINK_RETRY_MS.
+  *
+  * @param [IN] context unused
+  */
+static void UplinkTask(void *context)
+{
+    struct lorawan_tx_limits limits;
+    ReportWindow_t *report = NULL;
+    uint8_t frame[UINT8_MAX];
+    uint8_t size = 0;
+
+    /* One frame at a time, the alerts first */
+    if ((uplinkHandle != 0) || (alertHandle != 0) || AlertsPending() || !ReportsPending())
+    {
+        return;
+    }
+
+    if (lorawan_get_tx_limits(&limits) < 0)
+    {
+        /* MAC busy, the records wait in the queue */
+        Scheduler_Start(&uplinkTask, UPLINK_RETRY_MS, 0);
+        return;
+    }
 
-            /* Read sunlight level */
-            sunlightLevel = Temt_ReadData();
+    if (limits.mac_overhead > 0)
+    {
+        printf("MAC commands take %d of the %d bytes allowed at DR%d\n",
+               limits.mac_overhead, limits.max_payload, limits.datarate);
+    }
 
-            /* Create JSON Object */
-            cJSON *dataObject = cJSON_CreateObject();
+    for (uint8_t k = 0; (k < reportCount) && (report == NULL); k++)
+    {
+        if (GetReport(k)->JsonPending == true)
+        {
+            report = GetReport(k);
+        }
+    }
 
-            /* Add temperature, humidity, and sunlight to the JSON object */
-            cJSON_AddNumberToObject(dataObject, "Temperature", tempValue);
-            cJSON_AddNumberToObject(dataObject, "Humidity", humValue);
-            cJSON_AddNumberToObject(dataObject, "Sunlight", sunlightLevel);
+    if (report != NULL)
+    {
+        report->JsonPending = false;
 
-            char *json_string = cJSON_Print(dataObject);
+        /* Create JSON Object */
+        cJSON *dataObject = cJSON_CreateObject();
 
-            /* Send cjson data to the things network*/
-            printf("Sending unconfirmed data\n");
-            if (lorawan_send_unconfirmed((const char*)json_string, strlen(json_string), 2) < 0)
+        /* Add the temperature, humidity, and sunlight summaries to the JSON object */
+        AddSummaryToObject(dataObject, "Temperature", &report->Temp[0], 0.01);
+        AddSummaryToObject(dataObject, "Humidity", &report->Hum[0], 0.01);
+        for (uint8_t i = 1; i < CLIMATE_PROBES; i++)
+        {
+            char name[sizeof("Temperature") + 1];
+
+            snprintf(name, sizeof(name), "Temperature%d", i + 1);
+            AddSummaryToObject(dataObject, name, &report->Temp[i], 0.01);
+            snprintf(name, sizeof(name), "Humidity%d", i + 1);
+            AddSummaryToObject(dataObject, name, &report->Hum[i], 0.01);
+        }
+        AddSummaryToObject(dataObject, "Sunlight", &report->Sunlight, 1);
+        if (report->Records[CLIMATE_ERROR_RECORD].packed == false)
+        {
+            cJSON_AddNumberToObject(dataObject, "ClimateErrorRate", report->ClimateErrorRate / 100.0);
+        }
+        if (report->Timed == true)
+        {
+            cJSON_AddNumberToObject(dataObject, "Time", report->Time);
+        }
+
+        /* Unformatted, the indentation alone would not fit the slower datarates */
+        char *json_string = cJSON_PrintUnformatted(dataObject);
+        cJSON_Delete(dataObject);
+
+        if ((json_string != NULL) && (strlen(json_string) <= limits.available))
+        {
+            /* The JSON frame carries every reading of the window */
+            report->InFlight = PendingRecords(report);
+            report->JsonInFlight = true;
+            for (size_t i = 0; i < RECORD_COUNT; i++)
             {
-                printf("Unconfirmed sending message failed\n");
-            } else {
-                printf("Unconfirmed message sent\n");
+                report->Records[i].packed = true;
             }
 
-            /* Wait for up to 30 seconds for an event */
-            if (lorawan_process_timeout_ms(30000) == 0) {
+            uplinkHandle = SendFrame(json_string, strlen(json_string), JSON_PORT, false);
+            cJSON_free(json_string);
+            if (uplinkHandle == 0)
+            {
+                /* Radio busy with a frame, the window waits in the queue */
+                SettleUplink(true, NULL);
+                Scheduler_Start(&uplinkTask, UPLINK_RETRY_MS, 0);
+            }
+            return;
+        }
 
-                /* check if a downlink message was received */
-                receive_length = lorawan_receive(receive_buffer, sizeof(receive_buffer), &receive_port);
-                if (receive_length > -1) {
-                    printf("received a %d byte message on port %d: ", receive_length, receive_port);
+        if (json_string != NULL)
+        {
+            printf("JSON frame of %d bytes does not fit the %d available, sending Cayenne LPP\n",
+                   (int)strlen(json_string), limits.available);
+            cJSON_free(json_string);
+        }
 
-                    for (int i = 0; i < receive_length; i++) {
-                        printf("%02x", receive_buffer[i]);
-                    }
-                    printf("\n");
-                }
+        /* No JSON frame for the windows queued behind either at this datarate */
+        for (uint8_t k = 0; k < reportCount; k++)
+        {
+            GetReport(k)->JsonPending = false;
+        }
+    }
+
+    /* Fill the frame with the windows left, each behind its time */
+    for (uint8_t k = 0; k < reportCount; k++)
+    {
+        report = GetReport(k);
+
+        uint16_t waiting = PendingRecords(report);
+        uint8_t header = report->Timed ? LPP_TIME_SIZE : 0;
+        uint8_t room = (limits.available > size + header) ? limits.available - size - header : 0;
+        uint8_t packed;
+
+        if (waiting == 0)
+        {
+            continue;
+        }
+
+        /* Records with no time after a window time would be taken for that window */
+        if ((report->Timed == false) && (size > 0))
+        {
+            break;
+        }
+
+        packed = lorawan_pack_records(report->Records, RECORD_COUNT, room, frame + size + header);
+        if ((packed == 0) && (size == 0) && (header > 0))
+        {
+            /* Not even one record along with the time, the arrival time stands for it */
+            header = 0;
+            packed = lorawan_pack_records(report->Records, RECORD_COUNT, limits.available, frame);
+        }
+        if (packed == 0)
+        {
+            continue;
+        }
+
+        if (header > 0)
+        {
+            frame[size] = 0;
+            frame[size + 1] = LPP_TIME;
+            frame[size + 2] = (uint8_t)(report->Time >> 8);
+            frame[size + 3] = (uint8_t)report->Time;
+        }
+        size += header + packed;
+        report->InFlight = waiting & ~PendingRecords(report);
+    }
+
+    if ((size == 0) && (limits.mac_overhead == 0))
+    {
+        DropRecords("no room left");
+        return;
+    }
+
+    /* With no record, an empty frame sends the MAC commands in the way out */
+    uplinkHandle = SendFrame(frame, size, LPP_PORT, false);
+    if (uplinkHandle == 0)
+    {
+        /* Radio busy with a frame, the records wait in the queue */
+        SettleUplink(true, NULL);
+        Scheduler_Start(&uplinkTask, UPLINK_RETRY_MS, 0);
+    }
+}
+
+/**
+  * @brief Settles the records of the uplink in flight
+  *
+  * @param [IN] resend true to queue them again
+  * @param [IN] reason why they were not delivered, NULL when they were
+  */
+static void SettleUplink(bool resend, const char *reason)
+{
+    for (uint8_t k = 0; k < reportCount; k++)
+    {
+        ReportWindow_t *report = GetReport(k);
+
+        for (size_t i = 0; i < RECORD_COUNT; i++)
+        {
+            if ((report->InFlight & (1 << i)) == 0)
+            {
+                continue;
             }
 
-            /* Enter sleep mode */
-            EnterLowMode();
+            if (resend == true)
+            {
+                report->Records[i].packed = false;
+            }
+            else if (reason != NULL)
+            {
+                printf("Record on channel %d dropped, %s\n", recordChannels[i], reason);
+            }
         }
+
+        report->JsonPending |= resend && report->JsonInFlight;
+        report->JsonInFlight = false;
+        report->InFlight = 0;
     }
+
+    ReleaseReports();
 }
 
 /**
-  * @brief This function handles Low Entry in Low Mode.
+  * @brief Sends the pending alerts in one frame, at the next allowed slot
+  *
+  * @note A summary frame still held back by the duty cycle is superseded by
+  *       the alerts, its records go back in the queue. One already on the air
+  *       completes first, its TX done starts the task again.
+  *
+  * @param [IN] context unused
   */
-static void EnterLowMode(){
-    /* Set and Enable Interrupt Priority */
-    HAL_NVIC_SetPriority(RTC_WKUP_IRQn, 0, 0);
-    HAL_NVIC_EnableIRQ(RTC_WKUP_IRQn);
+static void AlertTask(void *context)
+{
+    struct lorawan_tx_limits limits;
+    uint8_t frame[ALERT_COUNT * ALERT_RECORD_SIZE];
+    uint16_t waiting = 0;
+    uint8_t size;
 
-    /* Setting up wake timer  */
-    if (HAL_RTCEx_SetWakeUpTimer_IT(&RTC_HandleStruct, 20 * 1024, RTC_WAKEUPCLOCK_RTCCLK_DIV16) != HAL_OK)
+    if ((alertHandle != 0) || !AlertsPending())
     {
-        printf("Error Setting up Low Power Wakeup Timer\n");
         return;
     }
 
-    /* Enter Low Power Mode */
-    LpmEnterLowPower(); 
+    if (lorawan_get_tx_limits(&limits) < 0)
+    {
+        limits.available = 0;
+    }
 
-    /* Disable IRQ */
-    HAL_NVIC_DisableIRQ(RTC_WKUP_IRQn);
+    for (size_t i = 0; i < ALERT_COUNT; i++)
+    {
+        if (alertRecords[i].packed == false)
+        {
+            waiting |= 1 << i;
+        }
+    }
+
+    size = lorawan_pack_records(alertRecords, ALERT_COUNT, limits.available, frame);
+
+    alertsInFlight = 0;
+    for (size_t i = 0; i < ALERT_COUNT; i++)
+    {
+        if ((waiting & (1 << i)) && alertRecords[i].packed)
+        {
+            alertsInFlight |= 1 << i;
+        }
+    }
+
+    if (size > 0)
+    {
+        alertHandle = SendFrame(frame, size, ALERT_PORT, ALERT_CONFIRMED);
+    }
+
+    if (alertHandle == 0)
+    {
+        /* Radio busy with a frame or no room, try again shortly */
+        RetryAlerts((size > 0) ? alertsInFlight : waiting, "refused");
+        Scheduler_Start(&alertTask, ALERT_RETRY_MS, 0);
+    }
 }
 
-/* RTC Wake up Handler */
 /**
-  * @brief This function is a RTC Wake up handler.
+  * @brief Tells whether alerts wait for a frame
+  *
+  * @return bool, true when an alert is not sent yet
   */
-void RTC_WKUP_IRQHandler( void )
+static bool AlertsPending(void)
 {
-    HAL_RTCEx_WakeUpTimerIRQHandler(&RTC_HandleStruct);
+    for (size_t i = 0; i < ALERT_COUNT; i++)
+    {
+        if (alertRecords[i].packed == false)
+        {
+            return true;
+        }
+    }
+    return false;
 }
 
-void HAL_RTCEx_WakeUpTimerEventCallback(RTC_HandleTypeDef *hrtc)
+/**
+  * @brief Puts alerts not delivered back in the queue, up to ALERT_MAX_ATTEMPTS
+  *
+  * @param [IN] alerts mask of the alerts
+  * @param [IN] reason why they were not delivered
+  */
+static void RetryAlerts(uint16_t alerts, const char *reason)
+{
+    for (size_t i = 0; i < ALERT_COUNT; i++)
+    {
+        if ((alerts & (1 << i)) == 0)
+        {
+            continue;
+        }
+
+        if (++alertRules[i].Attempts < ALERT_MAX_ATTEMPTS)
+        {
+            alertRecords[i].packed = false;
+        } else {
+            printf("Alert %s dropped, %s\n", alertRules[i].Name, reason);
+            alertRecords[i].packed = true;
+        }
+    }
+}
+
+/**
+  * @brief Asks the network for the time, again later until it answers
+  *
+  * @param [IN] context unused
+  */
+static void TimeSyncTask(void *context)
+{
+    if (lorawan_request_time() < 0)
+    {
+        printf("Time request refused\n");
+    }
+    Scheduler_Start(&timeSyncTask, TIME_SYNC_RETRY_MS, 0);
+}
+
+/**
+  * @brief Gets the time stamp of the records, GPS seconds
+  *
+  * @param [OUT] seconds GPS time, left alone before the first sync
+  *
+  * @return bool, false before the first sync
+  */
+static bool GetTimeStamp(uint32_t *seconds)
+{
+    SysTime_t time;
+
+    if (TimeSync_GetGpsTime(&time) == false)
+    {
+        return false;
+    }
+    *seconds = time.Seconds;
+    return true;
+}
+
+/**
+  * @brief Refreshes the watchdog
+  *
+  * @param [IN] context unused
+  */
+static void WatchdogTask(void *context)
 {
-    enterSleepMode = true;
-    /* Refreshes WatchDog timer */
     IWDG_Referesh();
 }
 
+/**
+  * @brief Queues a frame
+  *
+  * @note A frame refused by the duty cycle is held by the stack and goes out
+  *       as soon as the band is free.
+  *
+  * @param [IN] data pointer to the payload
+  * @param [IN] size payload size
+  * @param [IN] port application port
+  * @param [IN] confirmed true to have the frame acknowledged
+  *
+  * @return int, handle of the uplink, 0 on failure
+  */
+static int SendFrame(const void *data, uint8_t size, uint8_t port, bool confirmed)
+{
+    const char *type = confirmed ? "Confirmed" : "Unconfirmed";
+    int handle;
 
+    printf("Sending %s data on port %d\n", type, port);
+    handle = lorawan_send_scheduled(data, size, port, confirmed, NULL, NULL);
+    if (handle < 0)
+    {
+        printf("%s sending message failed\n", type);
+        return 0;
+    }
+    printf("%s message sent\n", type);
 
+    return handle;
+}
+
+/**
+  * @brief Reports and discards the records not sent, of every window
+  *
+  * @param [IN] reason why they are dropped
+  */
+static void DropRecords(const char *reason)
+{
+    for (uint8_t k = 0; k < reportCount; k++)
+    {
+        ReportWindow_t *report = GetReport(k);
+
+        for (size_t i = 0; i < RECORD_COUNT; i++)
+        {
+            if (report->Records[i].packed == false)
+            {
+                printf("Record on channel %d dropped, %s\n", recordChannels[i], reason);
+                report->Records[i].packed = true;
+            }
+        }
+        report->JsonPending = false;
+    }
+
+    ReleaseReports();
+}
+
+/**
+  * @brief Reacts to an event reported by the LoRaWAN stack
+  *
+  * @param [IN] event pointer to the event
+  */
+static void HandleLoRaWANEvent(const struct lorawan_event *event)
+{
+    const struct lorawan_rx_frame *frame;
+
+    switch (event->type)
+    {
+        case LORAWAN_EVENT_JOINED:
+            printf("Joined\n");
+            Sensor_StartAll();
+            Scheduler_Start(&reportTask, REPORT_PERIOD_MS, REPORT_PERIOD_MS);
+            Scheduler_Start(&timeSyncTask, 0, 0);
+            break;
+
+        case LORAWAN_EVENT_TIME_SYNCED:
+            TimeSync_OnUpdate();
+            Scheduler_Start(&timeSyncTask, TimeSync_GetResyncMs(), 0);
+            break;
+
+        case LORAWAN_EVENT_JOIN_FAILED:
+            /* Failed attempts are retried by the stack */
+            printf("Join failed, retrying\n");
+            break;
+
+        case LORAWAN_EVENT_RX:
+            /* Handle every downlink message received, in place */
+            while ((frame = lorawan_rx_borrow()) != NULL) {
+                printf("received a %d byte message on port %d (rssi %d, snr %d): ",
+                       frame->size, frame->port, frame->rssi, frame->snr);
 
+                for (int i = 0; i < frame->size; i++) {
+                    printf("%02x", frame->data[i]);
+                }
+                printf("\n");
+
+                lorawan_rx_release();
+            }
+            break;
+
+        case LORAWAN_EVENT_DUTY_CYCLE_BLOCKED:
+            printf("Duty cycle restricted, uplink delayed by %lu ms\n",
+                   (unsigned long)event->duty_cycle.next_tx_in_ms);
+            break;
+
+        case LORAWAN_EVENT_PAYLOAD_TOO_LARGE:
+            printf("Frame of %d bytes refused, %d allowed of which MAC commands take %d\n",
+                   event->payload.size, event->payload.max_payload, event->payload.mac_overhead);
+            break;
+
+        case LORAWAN_EVENT_TX_DONE:
+            /* Frames sent by the stack itself carry handle 0 */
+            if (event->tx.handle == 0)
+            {
+                break;
+            }
+
+            if (event->tx.handle == alertHandle)
+            {
+                alertHandle = 0;
+                if ((event->tx.status != LORAWAN_TX_DONE) && (event->tx.status != LORAWAN_TX_ACKED))
+                {
+                    RetryAlerts(alertsInFlight, "not delivered");
+                }
+            }
+            else if (event->tx.handle == uplinkHandle)
+            {
+                uplinkHandle = 0;
+                if (event->tx.status == LORAWAN_TX_SUPERSEDED)
+                {
+                    /* Held back by the duty cycle and preempted by alerts, sent again after them */
+                    SettleUplink(true, NULL);
+                } else {
+                    SettleUplink(false, (event->tx.status != LORAWAN_TX_DONE) ? "uplink failed" : NULL);
+                }
+            } else {
+                break;
+            }
+
+            /* Next frame, the alerts first, if any is left */
+            if (AlertsPending())
+            {
+                Scheduler_Start(&alertTask, 0, 0);
+            } else {
+                Scheduler_Start(&uplinkTask, 0, 0);
+            }
+            break;
+
+        default:
+            break;
+    }
+}
@@ -105,6 +105,7 @@ void UsageFault_Handler(void)
 
 /**
   * @brief This function handles Pendable request for system service.
+  * @note  Defined in irq-defer.c, it runs the deferred interrupt work.
   */
 // void PendSV_Handler(void)
 // {
@@ -6,10 +6,31 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include "gpio-board.h"
+#include "sensor.h"
 
+/**
+ * Read statistics, one failure cause counted per failed read
+ */
+typedef struct{
+    uint32_t Reads;
+    uint32_t NoResponse;        /* line never pulled low */
+    uint32_t ResponseTiming;    /* 80 us response out of bounds */
+    uint32_t BitTiming;         /* bit length out of bounds */
+    uint32_t Checksum;
+} DHT_Stats_t;
+
+/* Probes listed in DHT_PINS (board-config.h), one TIM2 channel each */
+#define DHT_MAX_SENSORS         4
+
+/* Temperature [0.01 degC] then humidity [0.01 %] of each probe, as the SHT3x */
+extern const SensorDriver_t DHT_SensorDriver;
 
 bool DHT_Init( void );
+uint8_t DHT_GetCount( void );
+bool DHT_Start( void );
 bool DHT_ProcessValues( void );
 uint8_t DHT_GetTempValue( void );
 uint8_t DHT_GetHumValue( void );
+void DHT_GetStats( DHT_Stats_t *stats );
+void DHT_GetProbeStats( uint8_t index, DHT_Stats_t *stats );
 #endif
\ No newline at end of file
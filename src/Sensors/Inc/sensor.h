@@ -0,0 +1,82 @@
+#ifndef __SENSOR_H
+#define __SENSOR_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "scheduler.h"
+
+#define SENSOR_MAX_CHANNELS     8
+
+/* Value of a channel not read, the others of the sample are valid */
+#define SENSOR_VALUE_INVALID    INT32_MIN
+
+/**
+ * Sensor driver interface
+ *
+ * @note Start, Poll and Suspend are optional. Read is called once the
+ *       acquisition time has elapsed after Start and Poll reports the values
+ *       ready. A failed acquisition is retried up to MaxRetries times, no
+ *       sooner than MinIntervalMs after the failure.
+ */
+typedef struct{
+    const char *Name;
+    bool ( *Init )( void );
+    bool ( *Start )( void );                /* begins an acquisition */
+    bool ( *Poll )( void );                 /* true once the values are ready */
+    bool ( *Read )( int32_t *values );      /* one value per channel */
+    void ( *Suspend )( void );              /* after each acquisition */
+    uint32_t AcquisitionMs;                 /* expected time from Start to ready */
+    uint32_t MinIntervalMs;                 /* least time between two acquisitions */
+    uint8_t MaxRetries;
+    uint8_t Channels;
+} SensorDriver_t;
+
+typedef enum{
+    SENSOR_IDLE,
+    SENSOR_ACQUIRING,
+    SENSOR_RETRY_WAIT
+} SensorState_t;
+
+typedef struct Sensor_s Sensor_t;
+
+typedef void ( *SensorSampleFn_t )( const Sensor_t *sensor, bool valid );
+
+/**
+ * Sensor sampled on its own schedule
+ *
+ * @note Owned by the caller, registered once with Sensor_Register.
+ */
+struct Sensor_s{
+    const SensorDriver_t *Driver;
+    SensorSampleFn_t OnSample;
+    uint32_t PeriodMs;                      /* current period, moved by the adaptive sampling */
+    uint32_t MinPeriodMs;
+    uint32_t MaxPeriodMs;
+    const int32_t *Steps;                   /* change worth a sample, per channel, NULL when fixed */
+    uint32_t WarmUpMs;                      /* powered time needed before a valid reading */
+    SensorState_t State;
+    SchedulerTask_t Task;
+    TimerTime_t StartTime;
+    TimerTime_t NextDeadline;
+    uint8_t Polls;
+    uint8_t Attempts;                       /* retries of the current sample */
+    int32_t Values[SENSOR_MAX_CHANNELS];
+    int32_t Reference[SENSOR_MAX_CHANNELS]; /* previous valid sample, for the rate of change */
+    TimerTime_t ReferenceTime;
+    bool HasReference;
+    uint32_t Samples;
+    uint32_t Failures;                      /* samples failed after the retries */
+    uint32_t Retries;
+    uint32_t MaxAcquisitionMs;              /* longest Start to Read */
+    uint32_t PeriodChanges;
+    struct Sensor_s *Next;
+};
+
+bool Sensor_Register( Sensor_t *sensor, const SensorDriver_t *driver, uint32_t periodMs, uint32_t warmUpMs, SensorSampleFn_t onSample );
+void Sensor_SetAdaptive( Sensor_t *sensor, uint32_t minPeriodMs, uint32_t maxPeriodMs, const int32_t *steps );
+void Sensor_StartAll( void );
+void Sensor_StopAll( void );
+const Sensor_t *Sensor_GetList( void );
+
+#endif
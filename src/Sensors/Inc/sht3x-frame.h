@@ -0,0 +1,35 @@
+#ifndef __SHT3X_FRAME_H
+#define __SHT3X_FRAME_H
+
+/* SHT3x measurement frame and read accounting, no hardware access */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Temperature, CRC, humidity, CRC */
+#define SHT3X_FRAME_SIZE        6
+
+/**
+ * SHT3x transfer failure causes
+ */
+typedef enum{
+    SHT3X_OK,
+    SHT3X_ERROR_NACK,
+    SHT3X_ERROR_BUS,
+    SHT3X_ERROR_CRC
+}sht3x_error;
+
+/**
+ * Read statistics, one failure cause counted per failed read
+ */
+typedef struct{
+    uint32_t Reads;
+    uint32_t Nack;              /* address not acknowledged, absent or still measuring */
+    uint32_t Bus;               /* bus error, arbitration lost or timeout */
+    uint32_t Crc;
+} SHT3x_Stats_t;
+
+uint8_t SHT3x_Crc( const uint8_t *data, uint8_t size );
+sht3x_error SHT3x_DecodeFrame( const uint8_t *frame, int16_t *temperature, uint16_t *humidity );
+bool SHT3x_CountError( SHT3x_Stats_t *stats, sht3x_error error );
+#endif
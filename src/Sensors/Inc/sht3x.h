@@ -0,0 +1,20 @@
+#ifndef __SHT3X_H
+#define __SHT3X_H
+
+/* Sensirion SHT30/31/35 on I2C1, the faster alternative to the DHT 11 */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "sensor.h"
+#include "sht3x-frame.h"
+
+/* Temperature [0.01 degC] then relative humidity [0.01 %] */
+extern const SensorDriver_t SHT3x_SensorDriver;
+
+bool SHT3x_Init( void );
+bool SHT3x_Start( void );
+bool SHT3x_ProcessValues( void );
+int16_t SHT3x_GetTempValue( void );
+uint16_t SHT3x_GetHumValue( void );
+void SHT3x_GetStats( SHT3x_Stats_t *stats );
+#endif
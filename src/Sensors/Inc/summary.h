@@ -0,0 +1,29 @@
+#ifndef __SUMMARY_H
+#define __SUMMARY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Fraction bits of the running mean, M2 carries twice as many */
+#define SUMMARY_FRACTION_BITS   8
+
+/**
+ * Running statistics of one channel over a reporting window
+ *
+ * @note Welford's update in fixed point, accurate to the Q8 mean resolution
+ *       whatever the number of samples, with no sum growing in the window.
+ */
+typedef struct{
+    uint32_t Count;
+    int32_t Min;
+    int32_t Max;
+    int64_t Mean;                   /* Q SUMMARY_FRACTION_BITS */
+    uint64_t M2;                    /* sum of squared deviations, Q 2 * SUMMARY_FRACTION_BITS */
+} Summary_t;
+
+void Summary_Reset( Summary_t *summary );
+void Summary_Add( Summary_t *summary, int32_t value );
+int32_t Summary_GetMean( const Summary_t *summary );
+uint32_t Summary_GetVariance( const Summary_t *summary );
+
+#endif
@@ -1,6 +1,12 @@
 #ifndef __TEMT_H
 #define __TEMT_H
 
+#include <stdint.h>
+#include "sensor.h"
+
+/* Luminosity, raw ADC value */
+extern const SensorDriver_t Temt_SensorDriver;
+
 void Temt_Init( void );
 void Temt_Config( void );
 uint16_t Temt_ReadData( void );
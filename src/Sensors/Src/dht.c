@@ -4,6 +4,11 @@
  * @author    Dean Prince Agbodjan
  * @brief     DHT Sensor Driver implementation
  *
+ * @note      Several DHT 11 probes, each one on a TIM2 input capture channel.
+ *            They get the start signal together and TIM2 timestamps the
+ *            falling edges of every line in hardware, so all the frames are
+ *            received in the time of one.
+ *
  ******************************************************************************
  */
 
@@ -18,6 +23,8 @@
 #include "stm32f4xx_hal_tim_ex.h"
 
 #include "dht.h"
+#include "gpio-mcu.h"
+#include "lpm-mcu.h"
 #include "board-config.h"
 
 /**
@@ -29,247 +36,553 @@ typedef enum{
     DHT22
 }dht_types;
 
+/**
+ * DHT read failure causes
+ */
+typedef enum{
+    DHT_ERROR_NO_RESPONSE,
+    DHT_ERROR_RESPONSE_TIMING,
+    DHT_ERROR_BIT_TIMING,
+    DHT_ERROR_CHECKSUM
+}dht_error;
+
+/**
+ * State of the probes, they are read together
+ */
+typedef enum{
+    DHT_IDLE,
+    DHT_STARTING,               /* start signal sent by DHT_Start */
+    DHT_CAPTURING
+}dht_state;
+
+/* Falling edges of a frame: the response, then the start of the 40 bits and of the end pulse */
+#define DHT_FRAME_EDGES         42
+
 /**
  * DHT Sensor type definition
  */
 typedef struct{
-    Gpio_t *obj;
-    TIM_HandleTypeDef *htim;
+    Gpio_t obj;
+    uint32_t channel;           /* TIM2 input capture channel */
     dht_types dht_t;
     uint8_t temperature;
     uint8_t humidity;
+    bool valid;                 /* last read succeeded */
+    volatile uint8_t edgeCount;
+    volatile bool overcapture;  /* an edge was lost */
+    uint32_t edges[DHT_FRAME_EDGES];
+    DHT_Stats_t stats;
 } DHTTypedef_t;
 
+/* Low time of the start signal */
+#define DHT_START_SIGNAL_MS     18
+
+/* Sampling period of the DHT 11, the least time between two reads */
+#define DHT_MIN_INTERVAL_MS     1000
+#define DHT_MAX_RETRIES         2
+
+/* Response and 40 bits take about 4.3 ms, TIM2 counts microseconds */
+#define DHT_CAPTURE_WINDOW_US   6000
+
+/* Falling edge to falling edge [us]: 80 us low + 80 us high, then 50 us low + 26-28 us or 70 us high */
+#define DHT_RESPONSE_MIN_US     150
+#define DHT_RESPONSE_MAX_US     176
+#define DHT_BIT0_MIN_US         60
+#define DHT_BIT0_MAX_US         95
+#define DHT_BIT1_MIN_US         100
+#define DHT_BIT1_MAX_US         145
+
+/**
+ * TIM2 input capture pins, alternate function 1
+ */
+static const struct{
+    PinNames pin;
+    uint32_t channel;
+} dhtCapturePins[] = {
+    { PA_0, TIM_CHANNEL_1 }, { PA_5, TIM_CHANNEL_1 }, { PA_15, TIM_CHANNEL_1 },
+    { PA_1, TIM_CHANNEL_2 }, { PB_3, TIM_CHANNEL_2 },
+    { PA_2, TIM_CHANNEL_3 }, { PB_10, TIM_CHANNEL_3 },
+    { PA_3, TIM_CHANNEL_4 }, { PB_11, TIM_CHANNEL_4 },
+};
+
 /* Variables */
-Gpio_t dht_GPIO_obj;
-DHTTypedef_t dht_DHT11;
+static const PinNames dhtPins[] = DHT_PINS;
+#define DHT_COUNT               (sizeof(dhtPins) / sizeof(dhtPins[0]))
+
+static DHTTypedef_t dhtSensors[DHT_COUNT];
+static DHTTypedef_t *dhtChannels[4];
+static volatile dht_state dhtState = DHT_IDLE;
+static uint32_t dhtCaptureStart;
 TIM_HandleTypeDef htim2;
+static LpmPeriph_t dhtPeriph;
 
 /* Private functions */
-static bool dhtInit( Gpio_t *obj, DHTTypedef_t *dht, dht_types dht_t,  PinNames pin );
+static bool dhtInit( DHTTypedef_t *dht, dht_types dht_t, PinNames pin );
 static void TIM_2_Init( TIM_HandleTypeDef *tim );
 static void TIM_2_DeInit( void );
-static bool setReadDHT( DHTTypedef_t *dht );
+static bool readDHT( void );
+static void dhtCapture( void );
+static bool dhtCaptureDone( void );
+static void dhtCaptureStop( void );
+static bool dhtDecode( DHTTypedef_t *dht );
+static bool dhtFail( DHTTypedef_t *dht, dht_error error );
+static void dhtSuspend( void *context );
+static void dhtResume( void *context );
+static bool dhtSensorRead( int32_t *values );
+
+_Static_assert(DHT_COUNT <= DHT_MAX_SENSORS, "DHT_PINS lists too many probes");
+
+const SensorDriver_t DHT_SensorDriver = {
+    .Name = "dht",
+    .Init = DHT_Init,
+    .Start = DHT_Start,
+    .Read = dhtSensorRead,
+    .AcquisitionMs = DHT_START_SIGNAL_MS,     /* the frames follow within 5 ms, read blocking */
+    .MinIntervalMs = DHT_MIN_INTERVAL_MS,
+    .MaxRetries = DHT_MAX_RETRIES,
+    .Channels = 2 * DHT_COUNT,
+};
 
 /**
- * @brief Initializes DHT sensor
+ * @brief Initializes the DHT probes listed in DHT_PINS
  *
  * @return bool, return the status of initialization
  */
 bool DHT_Init( void )
 {
-    return dhtInit(&dht_GPIO_obj, &dht_DHT11, DHT11, DHT_11_PIN);
+    /* Initialize and seup TIM 2 */
+    TIM_2_Init(&htim2);
+
+    for (uint8_t i = 0; i < DHT_COUNT; i++)
+    {
+        if (dhtInit(&dhtSensors[i], DHT11, dhtPins[i]) == false)
+        {
+            return false;
+        }
+    }
+
+    HAL_NVIC_SetPriority(TIM2_IRQn, 0, 0);
+    HAL_NVIC_EnableIRQ(TIM2_IRQn);
+
+    LpmRegisterPeriph(&dhtPeriph, "dht", dhtSuspend, dhtResume, NULL);
+
+    return true;
+}
+
+/**
+ * @brief Gets the number of DHT probes
+ *
+ * @return uint8_t, probes listed in DHT_PINS
+ */
+uint8_t DHT_GetCount( void )
+{
+    return DHT_COUNT;
+}
+
+/**
+ * @brief Sends the start signal to every probe, DHT_ProcessValues reads the
+ *        data once it has lasted DHT_START_SIGNAL_MS
+ *
+ * @note The MCU may sleep meanwhile, the lines are held low through it.
+ *
+ * @return bool, always true
+ */
+bool DHT_Start( void ) {
+    for (uint8_t i = 0; i < DHT_COUNT; i++)
+    {
+        GpioMcuInit(&dhtSensors[i].obj, dhtSensors[i].obj.pin, PIN_OUTPUT, PIN_PUSH_PULL, PIN_NO_PULL, 0);
+    }
+    dhtState = DHT_STARTING;
+    return true;
 }
 
 /**
  * @brief Process and reads DHT sensor data
  *
- * @return bool, return the status after processing and reading
+ * @note Sends the start signal itself, unless DHT_Start did.
+ *
+ * @return bool, true when at least one probe was read
  */
 bool DHT_ProcessValues( void ) {
-    return setReadDHT( &dht_DHT11 );
+    return readDHT();
 }
 
 /**
- * @brief Get temperature value
+ * @brief Get temperature value of the first probe
  *
  * @return returns temp value
  */
 uint8_t DHT_GetTempValue( void ){
-    return dht_DHT11.temperature;
+    return dhtSensors[0].temperature;
 }
 
 /**
- * @brief Get humidity value
+ * @brief Get humidity value of the first probe
  *
  * @return returns hum value
  */
 uint8_t DHT_GetHumValue( void ){
-    return dht_DHT11.humidity;
+    return dhtSensors[0].humidity;
+}
+
+/**
+ * @brief Get the read statistics of one probe
+ *
+ * @param [IN] index probe [0..DHT_GetCount()-1]
+ * @param [OUT] stats pointer to the statistics
+ */
+void DHT_GetProbeStats( uint8_t index, DHT_Stats_t *stats ){
+    *stats = dhtSensors[index].stats;
+}
+
+/**
+ * @brief Get the read statistics, summed over the probes
+ *
+ * @param [OUT] stats pointer to the statistics
+ */
+void DHT_GetStats( DHT_Stats_t *stats ){
+    *stats = (DHT_Stats_t){ 0 };
+
+    for (uint8_t i = 0; i < DHT_COUNT; i++)
+    {
+        stats->Reads += dhtSensors[i].stats.Reads;
+        stats->NoResponse += dhtSensors[i].stats.NoResponse;
+        stats->ResponseTiming += dhtSensors[i].stats.ResponseTiming;
+        stats->BitTiming += dhtSensors[i].stats.BitTiming;
+        stats->Checksum += dhtSensors[i].stats.Checksum;
+    }
+}
+
+/**
+ * @brief Sensor driver read
+ * @param [OUT] values temperature [0.01 degC] then humidity [0.01 %] of each
+ *                     probe, SENSOR_VALUE_INVALID for the probes not read
+ * @return bool, true when at least one probe was read
+ */
+static bool dhtSensorRead( int32_t *values ) {
+    bool valid = readDHT();
+
+    for (uint8_t i = 0; i < DHT_COUNT; i++)
+    {
+        values[2 * i] = dhtSensors[i].valid ? dhtSensors[i].temperature * 100 : SENSOR_VALUE_INVALID;
+        values[2 * i + 1] = dhtSensors[i].valid ? dhtSensors[i].humidity * 100 : SENSOR_VALUE_INVALID;
+    }
+    return valid;
 }
 
 /**
  * @brief Initializes DHT sensor
- * @param [IN] obj pointer to Gpio_t
  * @param [IN] obj pointer to DHTTypedef_t
  * @param [IN] dht_types (refer to dht.c)
  * @param [IN] pin names (refer to board-config.h)
  * @return bool, return the status of initialization
  */
-static bool dhtInit( Gpio_t *obj, DHTTypedef_t *dht, dht_types dht_t, PinNames pin )
+static bool dhtInit( DHTTypedef_t *dht, dht_types dht_t, PinNames pin )
 {
-    if ((obj == NULL) || (dht == NULL)) 
+    TIM_IC_InitTypeDef sConfigIC = {0};
+    uint32_t channel = 0xFF;
+
+    for (uint8_t i = 0; i < sizeof(dhtCapturePins) / sizeof(dhtCapturePins[0]); i++)
     {
-        printf("GPIO obj and DHT obj null\n");
+        if (dhtCapturePins[i].pin == pin)
+        {
+            channel = dhtCapturePins[i].channel;
+        }
+    }
+
+    if ((channel == 0xFF) || (dhtChannels[channel >> 2] != NULL))
+    {
+        printf("DHT pin %d has no free TIM2 channel\n", pin);
         return false;
     }
-    /* Initialize the gpio for dht */
-    GpioMcuInit(obj, pin, PIN_OUTPUT, PIN_PUSH_PULL, PIN_NO_PULL, 0xFF);
-    dht->obj = obj;
-    dht->dht_t = dht_t;
-    dht->htim = &htim2;
 
-    /* Initialize and seup TIM 2 */
-    TIM_2_Init(&htim2);
+    /* The line idles high */
+    GpioMcuInit(&dht->obj, pin, PIN_OUTPUT, PIN_PUSH_PULL, PIN_NO_PULL, 1);
+    dht->channel = channel;
+    dht->dht_t = dht_t;
+    dht->valid = false;
+    dhtChannels[channel >> 2] = dht;
+
+    /* Falling edges only, their spacing gives the bits */
+    sConfigIC.ICPolarity = TIM_INPUTCHANNELPOLARITY_FALLING;
+    sConfigIC.ICSelection = TIM_ICSELECTION_DIRECTTI;
+    sConfigIC.ICPrescaler = TIM_ICPSC_DIV1;
+    sConfigIC.ICFilter = 0;
+    if (HAL_TIM_IC_ConfigChannel(&htim2, &sConfigIC, channel) != HAL_OK)
+    {
+        printf("DHT capture channel configuration failed\n");
+        return false;
+    }
 
     return true;
 }
 
+/**
+ * @brief Switches TIM2 and the data pins off for low power
+ * @param [IN] unused
+ *
+ * The bus pull-ups keep the parked lines at their idle level.
+ */
+static void dhtSuspend( void *context )
+{
+    TIM_2_DeInit();
+
+    /* The start signal goes on through the sleep */
+    if (dhtState == DHT_IDLE)
+    {
+        for (uint8_t i = 0; i < DHT_COUNT; i++)
+        {
+            GpioMcuInit(&dhtSensors[i].obj, dhtSensors[i].obj.pin, PIN_ANALOGIC, PIN_PUSH_PULL, PIN_NO_PULL, 0);
+        }
+    }
+}
+
+/**
+ * @brief Restores TIM2 and drives the data pins high, ready for a start signal
+ * @param [IN] unused
+ */
+static void dhtResume( void *context )
+{
+    __HAL_RCC_TIM2_CLK_ENABLE();
+    if (dhtState == DHT_IDLE)
+    {
+        for (uint8_t i = 0; i < DHT_COUNT; i++)
+        {
+            GpioMcuInit(&dhtSensors[i].obj, dhtSensors[i].obj.pin, PIN_OUTPUT, PIN_PUSH_PULL, PIN_NO_PULL, 1);
+        }
+    }
+}
+
 /**
  * @brief read dht sensor values
- * @param [IN] pointer to dht
- * @return status of the read process
+ * @return true when at least one probe was read
  * Reading temp and hum values from DHT 11 involves 1. Initialization 2. Response 3. Data Transmission
  * 1. Initialization
  *  Pull the pin LOW for 18 ms. (set gpio output for this).
- * 
+ *
  * 2. Response
  *  DHT 11 will pull the line(pin) LOW for 80 us and the HIGH for 80us (set gpio input for this).
- * 
+ *
  * 3. Data Transmission
- *  DHT sends 40 bits of data. Each bit begins with a low signal that last 50us 
+ *  DHT sends 40 bits of data. Each bit begins with a low signal that last 50us
  *  The next high logic level length decides whether the bit is "1" or a "0"
  *  Bit is "0" when high logic signal is 26 - 28us
  *  Bit is "1" when low logic signal is around 70us
  *  Data = 8 bit integral Hum data + 8 bit decimal Hum data + 8 bit integral Temp data + 8 bit decimal Temp data + 8 bit checksum
+ *
+ * The lines are released together and captured with the interrupts enabled,
+ * the edges are timestamped by TIM2 whatever the interrupt latency.
 */
 
-static bool setReadDHT( DHTTypedef_t *dht )
+static bool readDHT( void )
 {
-    uint32_t rTimer1, rTimer2;
-    uint8_t dBit = 0, dBits[40];
-    uint8_t humValue = 0, tempValue = 0, checksum = 0, checksumValue;
-    
-    /* Pull the pin LOW for 18 ms. (set gpio output for this) */
-    GpioMcuWrite(dht->obj, 0);
-    HAL_Delay(18);
-    __disable_irq();
-
-    HAL_TIM_Base_Start(dht->htim);
-    __HAL_TIM_SET_COUNTER(dht->htim, 0);
-
-    /* DHT 11 will pull the line(pin) LOW for 80 us and the HIGH for 80us (set gpio input for this) */
-    GpioMcuInit(dht->obj, dht->obj->pin, PIN_INPUT, PIN_PUSH_PULL, PIN_NO_PULL, 0);   
-    while(GpioMcuRead(dht->obj) == 1)
+    bool valid = false;
+
+    /* Pull the pins LOW for 18 ms. (set gpio output for this) */
+    if (dhtState != DHT_STARTING)
     {
-        if((uint32_t) __HAL_TIM_GET_COUNTER(dht->htim)> 500)
-        {
-            __enable_irq();
-            printf("Pin is high\n");
-            return false;
-        }
+        DHT_Start();
+        HAL_Delay(DHT_START_SIGNAL_MS);
     }
-     
-    /* DHT 11 pulling low for 80us */
-    __HAL_TIM_SET_COUNTER(dht->htim, 0);
-    while(GpioMcuRead(dht->obj) == 0)
+
+    dhtCapture();
+
+    /* Sleep between the edges until every frame is in or the window is over */
+    while (dhtCaptureDone() == false)
     {
-        if((uint32_t) __HAL_TIM_GET_COUNTER(dht->htim)> 500)
-        {
-            __enable_irq();
-            return false;
-        }
+        __WFI();
     }
 
-    rTimer1 = (uint32_t) __HAL_TIM_GET_COUNTER(dht->htim);
-    if (rTimer1 < 75 || rTimer1 > 88){
-        __enable_irq();
-        printf("DHT11 Response for low pin: %ld\n", rTimer1);
-        return false;
+    dhtCaptureStop();
+
+    for (uint8_t i = 0; i < DHT_COUNT; i++)
+    {
+        dhtSensors[i].valid = dhtDecode(&dhtSensors[i]);
+        valid |= dhtSensors[i].valid;
     }
-    
 
-    /* DHT 11 pulling high for 80us */
-    __HAL_TIM_SET_COUNTER(dht->htim, 0);
-    while(GpioMcuRead(dht->obj) == 1)
+    return valid;
+}
+
+/**
+ * @brief Releases the lines and starts capturing their falling edges
+ */
+static void dhtCapture( void )
+{
+    __HAL_TIM_ENABLE(&htim2);
+    dhtCaptureStart = TIM2->CNT;
+    dhtState = DHT_CAPTURING;
+
+    for (uint8_t i = 0; i < DHT_COUNT; i++)
+    {
+        DHTTypedef_t *dht = &dhtSensors[i];
+
+        dht->edgeCount = 0;
+        dht->overcapture = false;
+        dht->stats.Reads++;
+
+        /* DHT 11 will pull the line(pin) LOW for 80 us and the HIGH for 80us (set gpio input for this) */
+        GpioMcuInit(&dht->obj, dht->obj.pin, PIN_ALTERNATE_FCT, PIN_PUSH_PULL, PIN_NO_PULL, GPIO_AF1_TIM2);
+
+        __HAL_TIM_CLEAR_FLAG(&htim2, (TIM_FLAG_CC1 | TIM_FLAG_CC1OF) << (dht->channel >> 2));
+        TIM_CCxChannelCmd(TIM2, dht->channel, TIM_CCx_ENABLE);
+        __HAL_TIM_ENABLE_IT(&htim2, TIM_IT_CC1 << (dht->channel >> 2));
+    }
+}
+
+/**
+ * @brief Checks the end of the capture
+ * @return true once every frame is in or the capture window is over
+ */
+static bool dhtCaptureDone( void )
+{
+    if ((TIM2->CNT - dhtCaptureStart) > DHT_CAPTURE_WINDOW_US)
+    {
+        return true;
+    }
+
+    for (uint8_t i = 0; i < DHT_COUNT; i++)
     {
-        if((uint32_t) __HAL_TIM_GET_COUNTER(dht->htim)> 500)
+        if (dhtSensors[i].edgeCount < DHT_FRAME_EDGES)
         {
-            __enable_irq();
             return false;
         }
     }
-    rTimer2 = (uint32_t) __HAL_TIM_GET_COUNTER(dht->htim);
+    return true;
+}
 
-    if (rTimer2 < 75 || rTimer2 > 88){
-        __enable_irq();
-        printf("DHT11 Response for high pin: %ld\n", rTimer2);
-        return false;
+/**
+ * @brief Stops the capture and drives the lines high again
+ */
+static void dhtCaptureStop( void )
+{
+    for (uint8_t i = 0; i < DHT_COUNT; i++)
+    {
+        DHTTypedef_t *dht = &dhtSensors[i];
+
+        __HAL_TIM_DISABLE_IT(&htim2, TIM_IT_CC1 << (dht->channel >> 2));
+        TIM_CCxChannelCmd(TIM2, dht->channel, TIM_CCx_DISABLE);
+        GpioMcuInit(&dht->obj, dht->obj.pin, PIN_OUTPUT, PIN_PUSH_PULL, PIN_NO_PULL, 1);
     }
-  
-    /* DHT sends 40 bits of data */
-    for(int i = 0; i < 40; i++){
-        __HAL_TIM_SET_COUNTER(dht->htim, 0);
 
-        /* Each bit begins with 50 us*/
-        while(GpioMcuRead(dht->obj) == 0)
-        {
-            if((uint32_t) __HAL_TIM_GET_COUNTER(dht->htim)> 500)
-            {
-                __enable_irq();
-                return false;
-            }
-        }
+    __HAL_TIM_DISABLE(&htim2);
+    dhtState = DHT_IDLE;
+}
 
-        /* Reading the logic length */
-        __HAL_TIM_SET_COUNTER(dht->htim, 0);
-        while(GpioMcuRead(dht->obj) == 1)
-        {
-            if((uint32_t) __HAL_TIM_GET_COUNTER(dht->htim)> 500)
-            {
-                __enable_irq();
-                return false;
-            }
-        }
+/**
+ * @brief Decodes the frame captured on a probe
+ * @param [IN] pointer to dht
+ * @return status of the read process
+ */
+static bool dhtDecode( DHTTypedef_t *dht )
+{
+    uint8_t data[5] = { 0 };
+
+    if (dht->edgeCount == 0)
+    {
+        return dhtFail(dht, DHT_ERROR_NO_RESPONSE);
+    }
+
+    /* DHT 11 pulling low then high for 80us */
+    uint32_t response = (dht->edgeCount > 1) ? (dht->edges[1] - dht->edges[0]) : 0;
+    if ((response < DHT_RESPONSE_MIN_US) || (response > DHT_RESPONSE_MAX_US))
+    {
+        return dhtFail(dht, DHT_ERROR_RESPONSE_TIMING);
+    }
+
+    if ((dht->edgeCount < DHT_FRAME_EDGES) || dht->overcapture)
+    {
+        return dhtFail(dht, DHT_ERROR_BIT_TIMING);
+    }
+
+    /* DHT sends 40 bits of data, MSB first */
+    for (int i = 0; i < 40; i++)
+    {
+        uint32_t period = dht->edges[i + 2] - dht->edges[i + 1];
 
-        rTimer1 = (uint32_t) __HAL_TIM_GET_COUNTER(dht->htim);
-        if (rTimer1 > 20 && rTimer1 < 30 ) dBit = 0;
-        else if (rTimer1 > 60 && rTimer1 < 80 ) dBit = 1;
-        else 
+        data[i / 8] <<= 1;
+        if ((period >= DHT_BIT0_MIN_US) && (period <= DHT_BIT0_MAX_US)) continue;
+        else if ((period >= DHT_BIT1_MIN_US) && (period <= DHT_BIT1_MAX_US)) data[i / 8] |= 1;
+        else
         {
-            return false; 
+            return dhtFail(dht, DHT_ERROR_BIT_TIMING);
         }
-        dBits[i] = dBit;
     }
 
-    HAL_TIM_Base_Stop(dht->htim);  
-    __enable_irq(); 
+    /* The checksum is the low byte of the sum of the four data bytes */
+    if ((uint8_t)(data[0] + data[1] + data[2] + data[3]) != data[4])
+    {
+        return dhtFail(dht, DHT_ERROR_CHECKSUM);
+    }
+
+    /* Integral humidity and temperature, the DHT 11 decimals are always 0 */
+    dht->humidity = data[0];
+    dht->temperature = data[2];
+
+    return true;
+}
+
+/**
+ * @brief Counts the cause of a failed read
+ * @param [IN] pointer to dht
+ * @param [IN] error cause
+ * @return false
+ */
+static bool dhtFail( DHTTypedef_t *dht, dht_error error )
+{
+    static const char * const causes[] = { "no response", "response timing", "bit timing", "checksum" };
 
-    /* Computing the hum and temp data */
-	for(int i = 0; i < 8; i++)
-	{
-		humValue += dBits[i];
-		humValue = humValue << 1;
-	}    
+    switch (error)
+    {
+        case DHT_ERROR_NO_RESPONSE: dht->stats.NoResponse++; break;
+        case DHT_ERROR_RESPONSE_TIMING: dht->stats.ResponseTiming++; break;
+        case DHT_ERROR_BIT_TIMING: dht->stats.BitTiming++; break;
+        case DHT_ERROR_CHECKSUM: dht->stats.Checksum++; break;
+    }
 
-	for(int i = 16; i < 24; i++)
-	{
-		tempValue += dBits[i];
-		tempValue = tempValue << 1;
-	}    
+    printf("DHT11 on pin %d read failed, %s\n", dht->obj.pin, causes[error]);
+    return false;
+}
 
-	for(int i = 32; i < 40; i++)
-	{
-		checksum += dBits[i];
-		checksum = checksum << 1;
-	}
+/**
+ * @brief Stores the falling edges captured on the DHT lines
+ *
+ * @note Runs at the highest priority, an edge must be read before the next
+ *       one on the same line, at least 70 us later.
+ */
+void TIM2_IRQHandler( void )
+{
+    uint32_t status = TIM2->SR;
+    uint32_t pending = status & TIM2->DIER & (TIM_SR_CC1IF | TIM_SR_CC2IF | TIM_SR_CC3IF | TIM_SR_CC4IF);
 
-	checksum = checksum >> 1;
-	humValue = humValue >> 1;
-	tempValue = tempValue >> 1;
+    /* Overcaptures, the flags are cleared by writing 0 */
+    uint32_t lost = status & (TIM_SR_CC1OF | TIM_SR_CC2OF | TIM_SR_CC3OF | TIM_SR_CC4OF);
+    TIM2->SR = ~lost;
 
-	checksumValue = humValue + tempValue;
+    while (pending != 0)
+    {
+        uint32_t index = __builtin_ctz(pending) - 1;
+        DHTTypedef_t *dht = dhtChannels[index];
+        pending &= pending - 1;
 
-//	if(genParity == checksum)
+        /* Reading the capture register clears its flag */
+        uint32_t edge = (&TIM2->CCR1)[index];
 
-	dht->temperature = tempValue;
-	dht->humidity = humValue;
+        if (lost & (TIM_SR_CC1OF << index))
+        {
+            dht->overcapture = true;
+        }
 
-    return true;
+        dht->edges[dht->edgeCount++] = edge;
+        if (dht->edgeCount == DHT_FRAME_EDGES)
+        {
+            __HAL_TIM_DISABLE_IT(&htim2, TIM_IT_CC1 << index);
+        }
+    }
 }
 
 /**
- * @brief Initialize and configure TIM2 
+ * @brief Initialize and configure TIM2
  * @param [IN] pointer to TIM_HandleTypeDef
  */
 static void TIM_2_Init(TIM_HandleTypeDef *tim)
@@ -279,7 +592,7 @@ static void TIM_2_Init(TIM_HandleTypeDef *tim)
     TIM_ClockConfigTypeDef sClockSourceConfig = {0};
     TIM_MasterConfigTypeDef sMasterConfig = {0};
 
-    /* Initialize the timer peripheral */
+    /* Initialize the timer peripheral, 1 us per count */
     tim->Instance = TIM2;
     tim->Init.Prescaler = 42 - 1;
     tim->Init.CounterMode = TIM_COUNTERMODE_UP;
@@ -304,10 +617,15 @@ static void TIM_2_Init(TIM_HandleTypeDef *tim)
     if (HAL_TIMEx_MasterConfigSynchronization(tim, &sMasterConfig) != HAL_OK){
         printf("Clock Master Configuraion Synchronization Error \n");
     }
+
+    if (HAL_TIM_IC_Init(tim) != HAL_OK)
+    {
+        printf("Timer Input Capture Initialization Failed\n");
+    }
 }
 
 /**
- * @brief DeInitialize TIM2 
+ * @brief DeInitialize TIM2
  *
  */
 static void TIM_2_DeInit(void)
@@ -315,4 +633,3 @@ static void TIM_2_DeInit(void)
     /* Disable TIM 2 clk */
     __HAL_RCC_TIM2_CLK_DISABLE();
 }
-
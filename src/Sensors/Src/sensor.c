@@ -0,0 +1,305 @@
+/**
+ ******************************************************************************
+ * @file      sensor.c
+ * @author    Dean Prince Agbodjan
+ * @brief     Sensor registry, each sensor sampled on its own schedule
+ *
+ * @note      Every sensor is a scheduler task with its own period. A task may
+ *            run a tenth of its period early, so the acquisitions falling due
+ *            close together share one wake-up. Acquisitions longer than a
+ *            wake-up (warm-up, conversion time) sleep in between and resume
+ *            on time, never early.
+ *
+ *            A failed acquisition is retried between one and two minimum
+ *            intervals of the sensor later, early enough in that window to
+ *            share a wake-up already planned when there is one.
+ *
+ *            With adaptive sampling, the period follows the fastest moving
+ *            channel: it is cut at once to the time that channel takes to
+ *            move by its step, and grows back by a quarter per sample when
+ *            the readings settle, between the bounds given.
+ *
+ ******************************************************************************
+ */
+
+/* Includes */
+#include <stdio.h>
+#include <stddef.h>
+
+#include "sensor.h"
+
+/* How early a sample may be taken, as a fraction of the period */
+#define SENSOR_SLACK_DIVIDER    10
+
+/* Polls of a sensor not ready after its acquisition time */
+#define SENSOR_POLL_MS          10
+#define SENSOR_POLL_RETRIES     5
+
+static Sensor_t *SensorList = NULL;
+
+static void SensorTask( void *context );
+static void SensorComplete( Sensor_t *sensor, bool valid );
+static void SensorAdapt( Sensor_t *sensor, TimerTime_t now );
+
+/**
+ * @brief Initializes a sensor and registers it, it is not sampled until started
+ *
+ * @param [IN] sensor pointer to the sensor, must stay valid
+ * @param [IN] driver sensor driver
+ * @param [IN] periodMs time between samples
+ * @param [IN] warmUpMs time from Start to a valid reading, on top of the
+ *                      acquisition time of the driver
+ * @param [IN] onSample called after each sample
+ *
+ * @return bool, false when the sensor failed to initialize
+ */
+bool Sensor_Register( Sensor_t *sensor, const SensorDriver_t *driver, uint32_t periodMs, uint32_t warmUpMs, SensorSampleFn_t onSample )
+{
+    if ((driver->Channels > SENSOR_MAX_CHANNELS) || (driver->Init() == false))
+    {
+        printf("Failed to initialize sensor %s\n", driver->Name);
+        return false;
+    }
+
+    sensor->Driver = driver;
+    sensor->OnSample = onSample;
+    sensor->PeriodMs = periodMs;
+    sensor->MinPeriodMs = periodMs;
+    sensor->MaxPeriodMs = periodMs;
+    sensor->Steps = NULL;
+    sensor->WarmUpMs = warmUpMs;
+    sensor->State = SENSOR_IDLE;
+    sensor->Samples = 0;
+    sensor->Failures = 0;
+    sensor->Retries = 0;
+    sensor->MaxAcquisitionMs = 0;
+    sensor->PeriodChanges = 0;
+
+    Scheduler_AddTask(&sensor->Task, SensorTask, sensor, driver->Name, periodMs / SENSOR_SLACK_DIVIDER);
+
+    sensor->Next = SensorList;
+    SensorList = sensor;
+    return true;
+}
+
+/**
+ * @brief Lets the period of a sensor follow the rate of change of its readings
+ *
+ * @note The registered period is the one sampling starts with.
+ *
+ * @param [IN] sensor pointer to the registered sensor
+ * @param [IN] minPeriodMs shortest period, when the readings move fast
+ * @param [IN] maxPeriodMs longest period, when the readings are stable
+ * @param [IN] steps change to resolve on each channel, 0 to ignore the
+ *                   channel, must stay valid
+ */
+void Sensor_SetAdaptive( Sensor_t *sensor, uint32_t minPeriodMs, uint32_t maxPeriodMs, const int32_t *steps )
+{
+    sensor->MinPeriodMs = minPeriodMs;
+    sensor->MaxPeriodMs = maxPeriodMs;
+    sensor->Steps = steps;
+}
+
+/**
+ * @brief Starts sampling the registered sensors, each one right away then
+ *        on its own period
+ */
+void Sensor_StartAll( void )
+{
+    for (Sensor_t *sensor = SensorList; sensor != NULL; sensor = sensor->Next)
+    {
+        sensor->HasReference = false;
+        sensor->Task.SlackMs = sensor->PeriodMs / SENSOR_SLACK_DIVIDER;
+        Scheduler_Start(&sensor->Task, 0, sensor->PeriodMs);
+    }
+}
+
+/**
+ * @brief Stops sampling the registered sensors
+ */
+void Sensor_StopAll( void )
+{
+    for (Sensor_t *sensor = SensorList; sensor != NULL; sensor = sensor->Next)
+    {
+        Scheduler_Stop(&sensor->Task);
+        if ((sensor->State == SENSOR_ACQUIRING) && (sensor->Driver->Suspend != NULL))
+        {
+            sensor->Driver->Suspend();
+        }
+        sensor->State = SENSOR_IDLE;
+    }
+}
+
+/**
+ * @brief Gets the registered sensors, with their statistics
+ *
+ * @return const Sensor_t*, first sensor of the list
+ */
+const Sensor_t *Sensor_GetList( void )
+{
+    return SensorList;
+}
+
+static void SensorTask( void *context )
+{
+    Sensor_t *sensor = context;
+    const SensorDriver_t *driver = sensor->Driver;
+
+    if (sensor->State == SENSOR_IDLE)
+    {
+        /* Periodic run, the scheduler already moved the deadline a period on */
+        sensor->NextDeadline = sensor->Task.Deadline;
+        sensor->Attempts = 0;
+    }
+
+    if (sensor->State != SENSOR_ACQUIRING)
+    {
+        sensor->StartTime = TimerGetCurrentTime();
+        sensor->Polls = 0;
+
+        if ((driver->Start != NULL) && (driver->Start() == false))
+        {
+            SensorComplete(sensor, false);
+            return;
+        }
+        sensor->State = SENSOR_ACQUIRING;
+
+        uint32_t waitMs = sensor->WarmUpMs + driver->AcquisitionMs;
+        if (waitMs > 0)
+        {
+            /* Sleep through the acquisition, the read must not come early */
+            sensor->Task.SlackMs = 0;
+            Scheduler_Start(&sensor->Task, waitMs, 0);
+            return;
+        }
+    }
+
+    if ((driver->Poll != NULL) && (driver->Poll() == false))
+    {
+        if (++sensor->Polls < SENSOR_POLL_RETRIES)
+        {
+            sensor->Task.SlackMs = 0;
+            Scheduler_Start(&sensor->Task, SENSOR_POLL_MS, 0);
+            return;
+        }
+        printf("Sensor %s not ready\n", driver->Name);
+        SensorComplete(sensor, false);
+        return;
+    }
+
+    SensorComplete(sensor, driver->Read(sensor->Values));
+}
+
+static void SensorComplete( Sensor_t *sensor, bool valid )
+{
+    const SensorDriver_t *driver = sensor->Driver;
+    TimerTime_t now = TimerGetCurrentTime();
+    uint32_t acquisitionMs = now - sensor->StartTime;
+
+    if (driver->Suspend != NULL)
+    {
+        driver->Suspend();
+    }
+    sensor->State = SENSOR_IDLE;
+
+    /* Retry within the period, the sample is only reported once */
+    if ((valid == false) && (sensor->Attempts < driver->MaxRetries) &&
+        ((int32_t)(sensor->NextDeadline - now) > (int32_t)(2 * driver->MinIntervalMs)))
+    {
+        sensor->Attempts++;
+        sensor->Retries++;
+        sensor->State = SENSOR_RETRY_WAIT;
+        sensor->Task.SlackMs = driver->MinIntervalMs;
+        Scheduler_Start(&sensor->Task, 2 * driver->MinIntervalMs, 0);
+        return;
+    }
+
+    if (valid) sensor->Samples++;
+    else sensor->Failures++;
+
+    if (acquisitionMs > sensor->MaxAcquisitionMs)
+    {
+        sensor->MaxAcquisitionMs = acquisitionMs;
+    }
+
+    if (valid)
+    {
+        SensorAdapt(sensor, now);
+    }
+
+    /* Back on the period if the acquisition took several wake-ups or retries, or the period moved */
+    if ((sensor->Task.PeriodMs == 0) || (sensor->Task.PeriodMs != sensor->PeriodMs))
+    {
+        int32_t delay = (int32_t)(sensor->NextDeadline - now);
+
+        sensor->Task.SlackMs = sensor->PeriodMs / SENSOR_SLACK_DIVIDER;
+        Scheduler_Start(&sensor->Task, (delay > 0) ? delay : 0, sensor->PeriodMs);
+    }
+
+    sensor->OnSample(sensor, valid);
+}
+
+static void SensorAdapt( Sensor_t *sensor, TimerTime_t now )
+{
+    const SensorDriver_t *driver = sensor->Driver;
+    uint32_t period = sensor->PeriodMs;
+
+    if (sensor->Steps == NULL)
+    {
+        return;
+    }
+
+    if (sensor->HasReference)
+    {
+        uint32_t elapsedMs = now - sensor->ReferenceTime;
+        uint64_t idealMs = sensor->MaxPeriodMs;
+
+        /* Time each channel takes to move by its step at the current rate */
+        for (uint8_t i = 0; i < driver->Channels; i++)
+        {
+            if ((sensor->Steps[i] <= 0) ||
+                (sensor->Values[i] == SENSOR_VALUE_INVALID) || (sensor->Reference[i] == SENSOR_VALUE_INVALID))
+            {
+                continue;
+            }
+
+            int64_t change = (int64_t)sensor->Values[i] - sensor->Reference[i];
+            if (change < 0)
+            {
+                change = -change;
+            }
+            if ((change > 0) && (((uint64_t)elapsedMs * sensor->Steps[i]) / change < idealMs))
+            {
+                idealMs = ((uint64_t)elapsedMs * sensor->Steps[i]) / change;
+            }
+        }
+
+        /* Fast attack, slow release */
+        uint32_t grownMs = period + period / 4;
+        period = (idealMs < grownMs) ? (uint32_t)idealMs : grownMs;
+
+        if (period < sensor->MinPeriodMs)
+        {
+            period = sensor->MinPeriodMs;
+        }
+        if (period > sensor->MaxPeriodMs)
+        {
+            period = sensor->MaxPeriodMs;
+        }
+    }
+
+    for (uint8_t i = 0; i < driver->Channels; i++)
+    {
+        sensor->Reference[i] = sensor->Values[i];
+    }
+    sensor->ReferenceTime = now;
+    sensor->HasReference = true;
+
+    if (period != sensor->PeriodMs)
+    {
+        /* The next sample moves with the period, from the one just taken */
+        sensor->NextDeadline += period - sensor->PeriodMs;
+        sensor->PeriodMs = period;
+        sensor->PeriodChanges++;
+    }
+}
@@ -0,0 +1,133 @@
+/**
+ ******************************************************************************
+ * @file      sht3x-check.c
+ * @author    Dean Prince Agbodjan
+ * @brief     Host check of the SHT3x frame decoding and read accounting
+ *
+ * @note      A simulated sensor builds the frames the SHT3x would send, some
+ *            of them corrupted on the bus, and the failed transfers are fed
+ *            to the same accounting as on the target. Not part of the
+ *            firmware, on a host:
+ *
+ *            cc -O2 -DSHT3X_CHECK_HOST -Isrc/Sensors/Inc \
+ *               src/Sensors/Src/sht3x-check.c src/Sensors/Src/sht3x-frame.c
+ *
+ ******************************************************************************
+ */
+
+/* Include */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "sht3x-frame.h"
+
+/**
+ * Reading of the simulated sensor and the values expected from it
+ */
+typedef struct{
+    uint16_t RawTemperature;
+    uint16_t RawHumidity;
+    int16_t Temperature;            /* [0.01 degC] */
+    uint16_t Humidity;              /* [0.01 %] */
+} SHT3xVector_t;
+
+/* Ends of the ranges, mid scale, then 25.00 degC / 50.00 % within rounding */
+static const SHT3xVector_t Vectors[] = {
+    { 0x0000, 0x0000, -4500, 0 },
+    { 0xFFFF, 0xFFFF, 13000, 10000 },
+    { 0x8000, 0x8000, 4250, 5000 },
+    { 0x6666, 0x7FFF, 2500, 4999 },
+};
+#define VECTOR_COUNT            (sizeof(Vectors) / sizeof(Vectors[0]))
+
+/**
+ * @brief Builds the frame the sensor sends for a reading
+ * @param [IN] vector reading
+ * @param [OUT] frame SHT3X_FRAME_SIZE bytes
+ */
+static void SimulateFrame( const SHT3xVector_t *vector, uint8_t *frame )
+{
+    frame[0] = (uint8_t)(vector->RawTemperature >> 8);
+    frame[1] = (uint8_t)vector->RawTemperature;
+    frame[2] = SHT3x_Crc(&frame[0], 2);
+    frame[3] = (uint8_t)(vector->RawHumidity >> 8);
+    frame[4] = (uint8_t)vector->RawHumidity;
+    frame[5] = SHT3x_Crc(&frame[3], 2);
+}
+
+/**
+ * @brief Checks the CRC, the conversions and the failure accounting
+ * @return bool, true when every check passes
+ */
+bool SHT3x_Check( void )
+{
+    static const uint8_t crcExample[2] = { 0xBE, 0xEF };
+    SHT3x_Stats_t stats = { 0 };
+    uint8_t frame[SHT3X_FRAME_SIZE];
+    int16_t temperature;
+    uint16_t humidity;
+
+    /* Datasheet CRC example */
+    if (SHT3x_Crc(crcExample, sizeof(crcExample)) != 0x92)
+    {
+        printf("SHT3x CRC example failed\n");
+        return false;
+    }
+
+    for (size_t i = 0; i < VECTOR_COUNT; i++)
+    {
+        SimulateFrame(&Vectors[i], frame);
+        if ((SHT3x_DecodeFrame(frame, &temperature, &humidity) != SHT3X_OK) ||
+            (temperature != Vectors[i].Temperature) || (humidity != Vectors[i].Humidity))
+        {
+            printf("SHT3x vector %d: %d / %u instead of %d / %u\n", (int)i, temperature, humidity,
+                   Vectors[i].Temperature, Vectors[i].Humidity);
+            return false;
+        }
+    }
+
+    /* A flipped bit in either word is caught and leaves the values alone */
+    for (uint8_t byte = 0; byte < SHT3X_FRAME_SIZE; byte++)
+    {
+        SimulateFrame(&Vectors[2], frame);
+        frame[byte] ^= 0x10;
+        temperature = 0;
+        humidity = 0;
+        if ((SHT3x_DecodeFrame(frame, &temperature, &humidity) != SHT3X_ERROR_CRC) ||
+            (temperature != 0) || (humidity != 0))
+        {
+            printf("SHT3x corrupted byte %d not detected\n", byte);
+            return false;
+        }
+    }
+
+    /* One cause counted per failed read, whatever the transfer reported */
+    static const sht3x_error failures[] = {
+        SHT3X_ERROR_NACK, SHT3X_ERROR_CRC, SHT3X_ERROR_BUS, SHT3X_ERROR_NACK, SHT3X_OK,
+    };
+    for (size_t i = 0; i < sizeof(failures) / sizeof(failures[0]); i++)
+    {
+        if (SHT3x_CountError(&stats, failures[i]) != false)
+        {
+            printf("SHT3x failed read not reported\n");
+            return false;
+        }
+    }
+    if ((stats.Nack != 2) || (stats.Crc != 1) || (stats.Bus != 2) || (stats.Reads != 0))
+    {
+        printf("SHT3x accounting: nack %lu crc %lu bus %lu\n", (unsigned long)stats.Nack,
+               (unsigned long)stats.Crc, (unsigned long)stats.Bus);
+        return false;
+    }
+
+    printf("SHT3x checks passed\n");
+    return true;
+}
+
+#if defined( SHT3X_CHECK_HOST )
+int main( void )
+{
+    return SHT3x_Check() ? 0 : 1;
+}
+#endif
@@ -0,0 +1,82 @@
+/**
+ ******************************************************************************
+ * @file      sht3x-frame.c
+ * @author    Dean Prince Agbodjan
+ * @brief     SHT3x measurement frame decoding and read accounting
+ *
+ * @note      Kept apart from the I2C1 and DMA code of sht3x.c so that it
+ *            builds on a host, see sht3x-check.c.
+ *
+ ******************************************************************************
+ */
+
+/* Include */
+#include "sht3x-frame.h"
+
+/**
+ * @brief CRC-8 of the sensor, polynomial 0x31, initial value 0xFF
+ * @param [IN] data pointer to the bytes
+ * @param [IN] size number of bytes
+ * @return crc
+ */
+uint8_t SHT3x_Crc( const uint8_t *data, uint8_t size )
+{
+    uint8_t crc = 0xFF;
+
+    for (uint8_t i = 0; i < size; i++)
+    {
+        crc ^= data[i];
+        for (uint8_t bit = 0; bit < 8; bit++)
+        {
+            crc = (crc & 0x80) ? (uint8_t)((crc << 1) ^ 0x31) : (uint8_t)(crc << 1);
+        }
+    }
+    return crc;
+}
+
+/**
+ * @brief Checks a measurement frame and converts it
+ * @param [IN] frame SHT3X_FRAME_SIZE bytes as received
+ * @param [OUT] temperature [0.01 degC], left alone on a CRC error
+ * @param [OUT] humidity [0.01 %], left alone on a CRC error
+ * @return SHT3X_OK or SHT3X_ERROR_CRC
+ */
+sht3x_error SHT3x_DecodeFrame( const uint8_t *frame, int16_t *temperature, uint16_t *humidity )
+{
+    if ((SHT3x_Crc(&frame[0], 2) != frame[2]) || (SHT3x_Crc(&frame[3], 2) != frame[5]))
+    {
+        return SHT3X_ERROR_CRC;
+    }
+
+    /* T = -45 + 175 * raw / (2^16 - 1), RH = 100 * raw / (2^16 - 1) */
+    uint32_t rawTemperature = ((uint32_t)frame[0] << 8) | frame[1];
+    uint32_t rawHumidity = ((uint32_t)frame[3] << 8) | frame[4];
+
+    *temperature = (int16_t)((int32_t)((17500 * rawTemperature) / 65535) - 4500);
+    *humidity = (uint16_t)((10000 * rawHumidity) / 65535);
+
+    return SHT3X_OK;
+}
+
+/**
+ * @brief Counts a failed read
+ * @param [IN] stats pointer to the statistics
+ * @param [IN] error failure cause
+ * @return bool, always false
+ */
+bool SHT3x_CountError( SHT3x_Stats_t *stats, sht3x_error error )
+{
+    switch (error)
+    {
+        case SHT3X_ERROR_NACK:
+            stats->Nack++;
+            break;
+        case SHT3X_ERROR_CRC:
+            stats->Crc++;
+            break;
+        default:
+            stats->Bus++;
+            break;
+    }
+    return false;
+}
@@ -0,0 +1,445 @@
+/**
+ ******************************************************************************
+ * @file      sht3x.c
+ * @author    Dean Prince Agbodjan
+ * @brief     SHT3x Sensor Driver implementation
+ *
+ * @note      Single shot measurements on I2C1 at 400 kHz. SHT3x_Start sends
+ *            the command and returns, the sensor measures for a few ms while
+ *            the MCU sleeps. The 6 result bytes are then received by DMA1,
+ *            the CPU waiting for them in WFI.
+ *
+ *            The HAL I2C module is not part of the project, the address and
+ *            command phases are driven on the I2C1 registers and the data
+ *            phase through the HAL DMA driver.
+ *
+ ******************************************************************************
+ */
+
+/* Include */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "stm32f4xx.h"
+#include "stm32f4xx_hal.h"
+#include "stm32f4xx_hal_dma.h"
+
+#include "sht3x.h"
+#include "gpio-board.h"
+#include "gpio-mcu.h"
+#include "lpm-mcu.h"
+#include "board-config.h"
+
+/* Single shot, no clock stretching, medium repeatability: 6 ms at most */
+#define SHT3X_CMD_MEASURE       0x240B
+#define SHT3X_CMD_SOFT_RESET    0x30A2
+
+#define SHT3X_MEASURE_MS        7
+#define SHT3X_RESET_MS          2
+
+/* A measurement left unread is lost, the next one may start right after */
+#define SHT3X_MIN_INTERVAL_MS   10
+#define SHT3X_MAX_RETRIES       2
+
+#define SHT3X_I2C_SPEED_HZ      400000
+#define SHT3X_TIMEOUT_US        1000
+
+/* Variables */
+static Gpio_t sht3xScl;
+static Gpio_t sht3xSda;
+static DMA_HandleTypeDef hdma_i2c1_rx;
+static uint8_t sht3xFrame[SHT3X_FRAME_SIZE];
+static volatile bool sht3xRxDone;
+static volatile bool sht3xRxError;
+static uint32_t sht3xTimeoutCycles;
+static int16_t sht3xTemperature;
+static uint16_t sht3xHumidity;
+static SHT3x_Stats_t sht3xStats;
+static LpmPeriph_t sht3xPeriph;
+
+/* Private functions */
+static void I2C_1_Init( void );
+static void sht3xPinsInit( void );
+static sht3x_error sht3xCommand( uint16_t command );
+static sht3x_error sht3xReceive( uint8_t *data, uint16_t size );
+static sht3x_error sht3xAddress( uint8_t direction );
+static bool sht3xWaitFlag( uint32_t flag );
+static sht3x_error sht3xAbort( void );
+static void sht3xDmaDone( DMA_HandleTypeDef *hdma );
+static void sht3xDmaError( DMA_HandleTypeDef *hdma );
+static void sht3xSuspend( void *context );
+static void sht3xResume( void *context );
+static bool sht3xSensorRead( int32_t *values );
+
+const SensorDriver_t SHT3x_SensorDriver = {
+    .Name = "sht3x",
+    .Init = SHT3x_Init,
+    .Start = SHT3x_Start,
+    .Read = sht3xSensorRead,
+    .AcquisitionMs = SHT3X_MEASURE_MS,
+    .MinIntervalMs = SHT3X_MIN_INTERVAL_MS,
+    .MaxRetries = SHT3X_MAX_RETRIES,
+    .Channels = 2,
+};
+
+/**
+ * @brief Initializes I2C1, the receive DMA and resets the sensor
+ *
+ * @return bool, false when the sensor does not answer
+ */
+bool SHT3x_Init( void )
+{
+    I2C_1_Init();
+
+    if (sht3xCommand(SHT3X_CMD_SOFT_RESET) != SHT3X_OK)
+    {
+        printf("SHT3x not found at 0x%02x\n", SHT3X_ADDRESS);
+        return false;
+    }
+    HAL_Delay(SHT3X_RESET_MS);
+
+    LpmRegisterPeriph(&sht3xPeriph, "sht3x", sht3xSuspend, sht3xResume, NULL);
+
+    return true;
+}
+
+/**
+ * @brief Starts a measurement, SHT3x_ProcessValues reads it once it has
+ *        lasted SHT3X_MEASURE_MS
+ *
+ * @note The sensor does not hold the bus meanwhile, the MCU may sleep.
+ *
+ * @return bool, false when the command was not acknowledged
+ */
+bool SHT3x_Start( void )
+{
+    sht3x_error error = sht3xCommand(SHT3X_CMD_MEASURE);
+
+    if (error != SHT3X_OK)
+    {
+        sht3xStats.Reads++;
+        return SHT3x_CountError(&sht3xStats, error);
+    }
+    return true;
+}
+
+/**
+ * @brief Reads the measurement started by SHT3x_Start
+ *
+ * @return bool, status of the read process
+ */
+bool SHT3x_ProcessValues( void )
+{
+    sht3x_error error;
+
+    sht3xStats.Reads++;
+
+    error = sht3xReceive(sht3xFrame, SHT3X_FRAME_SIZE);
+    if (error == SHT3X_OK)
+    {
+        error = SHT3x_DecodeFrame(sht3xFrame, &sht3xTemperature, &sht3xHumidity);
+    }
+
+    if (error != SHT3X_OK)
+    {
+        return SHT3x_CountError(&sht3xStats, error);
+    }
+    return true;
+}
+
+/**
+ * @brief Get temperature value
+ *
+ * @return returns temp value [0.01 degC]
+ */
+int16_t SHT3x_GetTempValue( void ){
+    return sht3xTemperature;
+}
+
+/**
+ * @brief Get humidity value
+ *
+ * @return returns hum value [0.01 %]
+ */
+uint16_t SHT3x_GetHumValue( void ){
+    return sht3xHumidity;
+}
+
+/**
+ * @brief Get the read statistics
+ *
+ * @param [OUT] stats pointer to the statistics
+ */
+void SHT3x_GetStats( SHT3x_Stats_t *stats ){
+    *stats = sht3xStats;
+}
+
+/**
+ * @brief Sensor driver read
+ * @param [OUT] values temperature then humidity
+ * @return bool, status of the read process
+ */
+static bool sht3xSensorRead( int32_t *values ) {
+    if (SHT3x_ProcessValues() == false)
+    {
+        return false;
+    }
+
+    values[0] = sht3xTemperature;
+    values[1] = sht3xHumidity;
+    return true;
+}
+
+/**
+ * @brief Sends a 16 bit command, MSB first
+ * @param [IN] command SHT3x command
+ * @return transfer status
+ */
+static sht3x_error sht3xCommand( uint16_t command )
+{
+    sht3x_error error = sht3xAddress(0);
+
+    if (error != SHT3X_OK)
+    {
+        return error;
+    }
+
+    I2C1->DR = (uint8_t)(command >> 8);
+    if (sht3xWaitFlag(I2C_SR1_TXE) == false)
+    {
+        return sht3xAbort();
+    }
+
+    I2C1->DR = (uint8_t)command;
+    if (sht3xWaitFlag(I2C_SR1_BTF) == false)
+    {
+        return sht3xAbort();
+    }
+
+    I2C1->CR1 |= I2C_CR1_STOP;
+    return SHT3X_OK;
+}
+
+/**
+ * @brief Receives bytes by DMA, sleeping until the last one is in
+ * @param [OUT] data pointer to the buffer
+ * @param [IN] size number of bytes, at least 2
+ * @return transfer status
+ */
+static sht3x_error sht3xReceive( uint8_t *data, uint16_t size )
+{
+    sht3x_error error;
+
+    sht3xRxDone = false;
+    sht3xRxError = false;
+
+    /* The last byte is NACKed by the hardware once the DMA counter runs out */
+    I2C1->CR2 |= I2C_CR2_DMAEN | I2C_CR2_LAST;
+    I2C1->CR1 |= I2C_CR1_ACK;
+    if (HAL_DMA_Start_IT(&hdma_i2c1_rx, (uint32_t)&I2C1->DR, (uint32_t)data, size) != HAL_OK)
+    {
+        /* Stream busy or in error, waiting would only run into the timeout */
+        return sht3xAbort();
+    }
+
+    error = sht3xAddress(1);
+    if (error != SHT3X_OK)
+    {
+        return error;
+    }
+
+    /* A few hundred us, the DMA interrupt ends the wait */
+    uint32_t start = DWT->CYCCNT;
+    while (!sht3xRxDone && !sht3xRxError)
+    {
+        if ((DWT->CYCCNT - start) > sht3xTimeoutCycles)
+        {
+            return sht3xAbort();
+        }
+        __WFI();
+    }
+
+    if (sht3xRxError)
+    {
+        return sht3xAbort();
+    }
+    return SHT3X_OK;
+}
+
+/**
+ * @brief Sends the start condition and the address
+ * @param [IN] direction 0 to write, 1 to read
+ * @return transfer status, the bus is released on failure
+ */
+static sht3x_error sht3xAddress( uint8_t direction )
+{
+    I2C1->CR1 |= I2C_CR1_START;
+    if (sht3xWaitFlag(I2C_SR1_SB) == false)
+    {
+        return sht3xAbort();
+    }
+
+    I2C1->DR = (SHT3X_ADDRESS << 1) | direction;
+    if (sht3xWaitFlag(I2C_SR1_ADDR) == false)
+    {
+        return sht3xAbort();
+    }
+
+    /* Reading SR1 then SR2 clears ADDR, the DMA takes over a read from there */
+    (void)I2C1->SR1;
+    (void)I2C1->SR2;
+    return SHT3X_OK;
+}
+
+/**
+ * @brief Waits for an I2C1 event
+ * @param [IN] flag SR1 flag
+ * @return bool, false on bus error, NACK or timeout
+ */
+static bool sht3xWaitFlag( uint32_t flag )
+{
+    uint32_t start = DWT->CYCCNT;
+
+    while ((I2C1->SR1 & flag) == 0)
+    {
+        if ((I2C1->SR1 & (I2C_SR1_AF | I2C_SR1_BERR | I2C_SR1_ARLO)) ||
+            ((DWT->CYCCNT - start) > sht3xTimeoutCycles))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Ends a failed transfer and releases the bus
+ * @return failure cause
+ */
+static sht3x_error sht3xAbort( void )
+{
+    sht3x_error error = (I2C1->SR1 & I2C_SR1_AF) ? SHT3X_ERROR_NACK : SHT3X_ERROR_BUS;
+
+    HAL_DMA_Abort(&hdma_i2c1_rx);
+    I2C1->CR2 &= ~(I2C_CR2_DMAEN | I2C_CR2_LAST);
+    I2C1->SR1 &= ~(I2C_SR1_AF | I2C_SR1_BERR | I2C_SR1_ARLO);
+    I2C1->CR1 |= I2C_CR1_STOP;
+
+    /* A bus stuck by a lost sensor needs the peripheral reset */
+    if (error == SHT3X_ERROR_BUS)
+    {
+        I2C1->CR1 |= I2C_CR1_SWRST;
+        I2C1->CR1 &= ~I2C_CR1_SWRST;
+        I2C_1_Init();
+    }
+    return error;
+}
+
+/**
+ * @brief DMA transfer complete, ends the read
+ * @param [IN] pointer to DMA_HandleTypeDef
+ */
+static void sht3xDmaDone( DMA_HandleTypeDef *hdma )
+{
+    I2C1->CR1 |= I2C_CR1_STOP;
+    I2C1->CR2 &= ~(I2C_CR2_DMAEN | I2C_CR2_LAST);
+    sht3xRxDone = true;
+}
+
+/**
+ * @brief DMA transfer error
+ * @param [IN] pointer to DMA_HandleTypeDef
+ */
+static void sht3xDmaError( DMA_HandleTypeDef *hdma )
+{
+    sht3xRxError = true;
+}
+
+/**
+ * @brief Switches I2C1, DMA1 and the bus pins off for low power
+ * @param [IN] unused
+ *
+ * The bus pull-ups keep the parked lines at their idle level, a measurement
+ * in progress goes on in the sensor.
+ */
+static void sht3xSuspend( void *context )
+{
+    __HAL_RCC_I2C1_CLK_DISABLE();
+    __HAL_RCC_DMA1_CLK_DISABLE();
+
+    GpioMcuInit(&sht3xScl, SHT3X_SCL, PIN_ANALOGIC, PIN_PUSH_PULL, PIN_NO_PULL, 0);
+    GpioMcuInit(&sht3xSda, SHT3X_SDA, PIN_ANALOGIC, PIN_PUSH_PULL, PIN_NO_PULL, 0);
+}
+
+/**
+ * @brief Restores I2C1, DMA1 and the bus pins, the registers kept their setup
+ * @param [IN] unused
+ */
+static void sht3xResume( void *context )
+{
+    __HAL_RCC_DMA1_CLK_ENABLE();
+    __HAL_RCC_I2C1_CLK_ENABLE();
+
+    sht3xPinsInit();
+}
+
+/**
+ * @brief Puts the bus pins on I2C1, open drain with the external pull-ups
+ */
+static void sht3xPinsInit( void )
+{
+    GpioMcuInit(&sht3xScl, SHT3X_SCL, PIN_ALTERNATE_FCT, PIN_OPEN_DRAIN, PIN_NO_PULL, GPIO_AF4_I2C1);
+    GpioMcuInit(&sht3xSda, SHT3X_SDA, PIN_ALTERNATE_FCT, PIN_OPEN_DRAIN, PIN_NO_PULL, GPIO_AF4_I2C1);
+}
+
+/**
+ * @brief Initialize and configure I2C1 in fast mode and its receive DMA stream
+ */
+static void I2C_1_Init( void )
+{
+    uint32_t pclk1 = HAL_RCC_GetPCLK1Freq();
+
+    __HAL_RCC_I2C1_CLK_ENABLE();
+    __HAL_RCC_DMA1_CLK_ENABLE();
+
+    sht3xPinsInit();
+
+    sht3xTimeoutCycles = (SystemCoreClock / 1000000) * SHT3X_TIMEOUT_US;
+
+    /* Fast mode, duty 2: SCL = PCLK1 / (3 * CCR), 300 ns rise time at most */
+    I2C1->CR1 = 0;
+    I2C1->CR2 = pclk1 / 1000000;
+    I2C1->CCR = I2C_CCR_FS | ((pclk1 + 3 * SHT3X_I2C_SPEED_HZ - 1) / (3 * SHT3X_I2C_SPEED_HZ));
+    I2C1->TRISE = (pclk1 / 1000000) * 300 / 1000 + 1;
+    I2C1->CR1 = I2C_CR1_PE;
+
+    /* I2C1_RX is DMA1 stream 0 channel 1 */
+    hdma_i2c1_rx.Instance = DMA1_Stream0;
+    hdma_i2c1_rx.Init.Channel = DMA_CHANNEL_1;
+    hdma_i2c1_rx.Init.Direction = DMA_PERIPH_TO_MEMORY;
+    hdma_i2c1_rx.Init.PeriphInc = DMA_PINC_DISABLE;
+    hdma_i2c1_rx.Init.MemInc = DMA_MINC_ENABLE;
+    hdma_i2c1_rx.Init.PeriphDataAlignment = DMA_PDATAALIGN_BYTE;
+    hdma_i2c1_rx.Init.MemDataAlignment = DMA_MDATAALIGN_BYTE;
+    hdma_i2c1_rx.Init.Mode = DMA_NORMAL;
+    hdma_i2c1_rx.Init.Priority = DMA_PRIORITY_LOW;
+    hdma_i2c1_rx.Init.FIFOMode = DMA_FIFOMODE_DISABLE;
+
+    if (HAL_DMA_Init(&hdma_i2c1_rx) != HAL_OK)
+    {
+        printf("I2C1 DMA Initialization Failed\n");
+    }
+    hdma_i2c1_rx.XferCpltCallback = sht3xDmaDone;
+    hdma_i2c1_rx.XferErrorCallback = sht3xDmaError;
+
+    HAL_NVIC_SetPriority(DMA1_Stream0_IRQn, 5, 0);
+    HAL_NVIC_EnableIRQ(DMA1_Stream0_IRQn);
+}
+
+/**
+ * @brief Handles DMA1 stream 0 interrupt request, I2C1 receive
+ */
+void DMA1_Stream0_IRQHandler( void )
+{
+    HAL_DMA_IRQHandler(&hdma_i2c1_rx);
+}
@@ -0,0 +1,100 @@
+/**
+ ******************************************************************************
+ * @file      summary.c
+ * @author    Dean Prince Agbodjan
+ * @brief     Per window statistics of the sensor channels
+ *
+ * @note      Each sample updates the count, extremes, mean and sum of squared
+ *            deviations in place, so a window of any length summarises into
+ *            the same few values and the uplink size does not follow the
+ *            sampling rate.
+ *
+ ******************************************************************************
+ */
+
+/* Includes */
+#include "summary.h"
+
+#define SUMMARY_ONE             ((int64_t)1 << SUMMARY_FRACTION_BITS)
+
+/**
+ * @brief Empties the window
+ *
+ * @param [IN] summary pointer to the statistics
+ */
+void Summary_Reset( Summary_t *summary )
+{
+    *summary = (Summary_t){ 0 };
+}
+
+/**
+ * @brief Adds a sample to the window
+ *
+ * @note The mean moves by delta / n, rounded to the nearest Q8 step rather
+ *       than truncated so the error does not pile up along a trend, and M2
+ *       grows by delta * (x - new mean), a product that is never negative.
+ *
+ * @param [IN] summary pointer to the statistics
+ * @param [IN] value sample, in the unit of the channel
+ */
+void Summary_Add( Summary_t *summary, int32_t value )
+{
+    int64_t x = (int64_t)value * SUMMARY_ONE;
+
+    summary->Count++;
+    if (summary->Count == 1)
+    {
+        summary->Min = value;
+        summary->Max = value;
+        summary->Mean = x;
+        summary->M2 = 0;
+        return;
+    }
+
+    if (value < summary->Min)
+    {
+        summary->Min = value;
+    }
+    if (value > summary->Max)
+    {
+        summary->Max = value;
+    }
+
+    int64_t delta = x - summary->Mean;
+    int64_t half = (int64_t)(summary->Count / 2);
+    summary->Mean += ((delta >= 0) ? delta + half : delta - half) / (int64_t)summary->Count;
+    summary->M2 += (uint64_t)(delta * (x - summary->Mean));
+}
+
+/**
+ * @brief Gets the mean of the window, rounded to the nearest unit
+ *
+ * @param [IN] summary pointer to the statistics
+ *
+ * @return int32_t, mean, 0 for an empty window
+ */
+int32_t Summary_GetMean( const Summary_t *summary )
+{
+    int64_t mean = summary->Mean + ((summary->Mean >= 0) ? SUMMARY_ONE / 2 : -SUMMARY_ONE / 2);
+
+    return (int32_t)(mean / SUMMARY_ONE);
+}
+
+/**
+ * @brief Gets the sample variance of the window
+ *
+ * @param [IN] summary pointer to the statistics
+ *
+ * @return uint32_t, variance in the square of the channel unit, 0 below two samples
+ */
+uint32_t Summary_GetVariance( const Summary_t *summary )
+{
+    if (summary->Count < 2)
+    {
+        return 0;
+    }
+
+    uint64_t variance = (summary->M2 / (summary->Count - 1)) >> (2 * SUMMARY_FRACTION_BITS);
+
+    return (variance > UINT32_MAX) ? UINT32_MAX : (uint32_t)variance;
+}
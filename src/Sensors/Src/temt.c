@@ -19,6 +19,17 @@
 
 Adc_t adc_obj;
 
+static bool temtSensorInit( void );
+static bool temtSensorRead( int32_t *values );
+
+const SensorDriver_t Temt_SensorDriver = {
+    .Name = "temt",
+    .Init = temtSensorInit,
+    .Read = temtSensorRead,
+    .AcquisitionMs = 0,         /* one conversion, read right away */
+    .Channels = 1,
+};
+
 /**
  * @brief Initializes TEMT600 sensor
  *
@@ -43,4 +54,24 @@ uint16_t Temt_ReadData( void ){
     return  (AdcMcuReadChannel(&adc_obj, 3));
 }
 
+/**
+ * @brief Sensor driver initialization
+ * @return bool, always true
+ */
+static bool temtSensorInit( void ){
+    Temt_Init();
+    Temt_Config();
+    return true;
+}
+
+/**
+ * @brief Sensor driver read
+ * @param [OUT] values luminosity
+ * @return bool, always true
+ */
+static bool temtSensorRead( int32_t *values ){
+    values[0] = Temt_ReadData();
+    return true;
+}
+
 
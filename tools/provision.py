@@ -0,0 +1,127 @@
+#!/usr/bin/env python3
+"""
+Stamps per-device LoRaWAN credentials into a built firmware image.
+
+The firmware keeps its credentials in the .lorawan_credentials flash section
+(see src/Board/Inc/credentials.h). This tool finds that record in the .bin by
+its marker and rewrites the fields, so thousands of units can be flashed from
+a single build.
+
+Single device:
+    provision.py build/stm32f401-lorawan-node.bin -o node.bin \\
+        --dev-eui 70B3D57ED005CB05 --join-eui 0000000000000000 \\
+        --app-key D9EE772A323797A6F16ABCE86B6473A9
+
+Batch, one image per CSV row (columns named like the options, e.g. dev_eui):
+    provision.py build/stm32f401-lorawan-node.bin --csv devices.csv -d out/
+"""
+
+import argparse
+import csv
+import os
+import struct
+import sys
+
+MAGIC = b"LWCRED01"
+
+# Layout of Credentials_t, must match src/Board/Inc/credentials.h
+FLAGS_OFFSET = 8
+FIELDS = {
+    #  name          flag    offset  size
+    "dev_eui":      (1 << 0, 12,     8),
+    "join_eui":     (1 << 1, 20,     8),
+    "app_key":      (1 << 2, 28,     16),
+    "dev_addr":     (1 << 3, 44,     4),
+    "nwk_s_key":    (1 << 4, 48,     16),
+    "app_s_key":    (1 << 5, 64,     16),
+    "channel_mask": (1 << 6, 80,     12),
+}
+RECORD_SIZE = 92
+
+
+def find_record(image):
+    offset = image.find(MAGIC)
+    if offset < 0:
+        sys.exit("credentials record not found, is this a firmware .bin?")
+    if image.find(MAGIC, offset + 1) >= 0:
+        sys.exit("credentials marker found more than once")
+    if offset + RECORD_SIZE > len(image):
+        sys.exit("credentials record truncated")
+    return offset
+
+
+def encode(name, value):
+    value = value.strip()
+    _, _, size = FIELDS[name]
+    try:
+        raw = bytes.fromhex(value)
+    except ValueError:
+        sys.exit("%s: '%s' is not a hex string" % (name, value))
+    if len(raw) != size:
+        sys.exit("%s: expected %d hex digits, got %d" % (name, size * 2, len(value)))
+
+    # Integers are stored little-endian, EUIs and keys MSB first
+    if name == "dev_addr":
+        return struct.pack("<I", int.from_bytes(raw, "big"))
+    if name == "channel_mask":
+        words = struct.unpack(">6H", raw)
+        return struct.pack("<6H", *words)
+    return raw
+
+
+def stamp(image, values):
+    image = bytearray(image)
+    base = find_record(image)
+    flags = image[base + FLAGS_OFFSET]
+
+    for name, value in values.items():
+        if value is None or value == "":
+            continue
+        flag, offset, size = FIELDS[name]
+        image[base + offset:base + offset + size] = encode(name, value)
+        flags |= flag
+
+    image[base + FLAGS_OFFSET] = flags
+    return bytes(image)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("image", help="firmware .bin produced by the build")
+    parser.add_argument("-o", "--output", help="output .bin (single device)")
+    parser.add_argument("--csv", help="CSV file with one device per row")
+    parser.add_argument("-d", "--output-dir", default=".",
+                        help="output directory for --csv, files are named <dev_eui>.bin")
+    for name in FIELDS:
+        parser.add_argument("--" + name.replace("_", "-"), dest=name)
+    args = parser.parse_args()
+
+    with open(args.image, "rb") as f:
+        image = f.read()
+
+    if args.csv:
+        os.makedirs(args.output_dir, exist_ok=True)
+        count = 0
+        with open(args.csv, newline="") as f:
+            for row in csv.DictReader(f):
+                values = {k: row.get(k) for k in FIELDS}
+                name = (row.get("dev_eui") or "device%d" % count).strip()
+                path = os.path.join(args.output_dir, name + ".bin")
+                with open(path, "wb") as out:
+                    out.write(stamp(image, values))
+                count += 1
+        print("provisioned %d images in %s" % (count, args.output_dir))
+        return
+
+    if not args.output:
+        parser.error("--output is required unless --csv is given")
+
+    values = {k: getattr(args, k) for k in FIELDS}
+    with open(args.output, "wb") as out:
+        out.write(stamp(image, values))
+    print("provisioned %s" % args.output)
+
+
+if __name__ == "__main__":
+    main()